@@ -0,0 +1,747 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <utility>
+#include "AsyncFtpSession.h"
+#include "ConnectRace.h"
+#include "FtpReplyFramer.h"
+#include "Utility.h"
+
+
+static const size_t CTRL_READ_SIZE        = 2048;
+static const size_t DATA_CHUNK_SIZE       = 65536;
+
+// chunks read from one data connection per wake up, so a fast transfer does not starve the other sessions
+static const int    DATA_CHUNKS_PER_EVENT = 16;
+
+
+struct AsyncFtpSession::Impl {
+    struct Retrieval {
+        std::string remotePath;
+        DataSink sink;
+        Completion completion;
+    };
+
+    using Address = SocketAddress;
+
+    using Clock = std::chrono::steady_clock;
+
+
+    Impl(EventLoop &eventLoop, std::ostream *log)
+        : loop(eventLoop), logger{log}, timeouts{}, connectAttemptDelay{FtpService::CONNECT_ATTEMPT_DELAY}
+    {}
+
+
+    /*
+     * Helper function to start the timer of the timeout. Nothing is started for the timeout 0
+     */
+    void startTimer(EventLoop::TimerId &timer, std::chrono::milliseconds timeout, std::function<void()> handler) {
+        cancelTimer(timer);
+        if (timeout.count() == 0)
+            return;
+
+        timer = loop.addTimer(timeout, [&timer, handler]() {
+            timer = 0;
+            handler();
+        });
+    }
+
+
+    void cancelTimer(EventLoop::TimerId &timer) {
+        if (timer == 0)
+            return;
+
+        loop.cancelTimer(timer);
+        timer = 0;
+    }
+
+
+    void cancelTimers() {
+        cancelTimer(attemptTimer);
+        cancelTimer(pauseTimer);
+        cancelTimer(connectTimer);
+        cancelTimer(idleTimer);
+        cancelTimer(transferTimer);
+    }
+
+
+    /*
+     * Helper function to note that the connection made progress, and to watch it for the idle timeout
+     */
+    void touch() {
+        lastActivity = Clock::now();
+        if (idleTimer == 0)
+            startTimer(idleTimer, timeouts.idle, [this]() { onIdleTimer(); });
+    }
+
+
+    /*
+     * Helper function to fail the session once it waits for the server longer than the idle timeout.
+     * The timer is started again for the rest of the timeout if there was progress in between, and not
+     * at all while the session is idle, since then nothing is expected from the server
+     */
+    void onIdleTimer() {
+        if (state == CONNECTING || state == DATA_CONNECTING || state == IDLE || state == FAILED || state == CLOSED)
+            return;
+
+        // the wait for the rate limit is no idle time
+        if (pauseTimer != 0)
+            lastActivity = Clock::now();
+
+        auto idleFor = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - lastActivity);
+        if (idleFor < timeouts.idle) {
+            startTimer(idleTimer, timeouts.idle - idleFor, [this]() { onIdleTimer(); });
+            return;
+        }
+
+        bool transferring = (state == RETR_SENT || state == TRANSFERRING) && dataSockfd != -1;
+        fail(TimeoutException(transferring ? "reading data connection" : "reading socket").what());
+    }
+
+
+    /*
+     * Helper function to open a non-blocking socket and start connecting it to the address.
+     * Function returns -1 if the connection cannot be started
+     */
+    static int connectNonBlocking(const Address &address) {
+        int fd = socket(address.first.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return -1;
+
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&address.first), address.second) == -1 && errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+
+    /*
+     * Helper function to check the result of a non-blocking connect once the socket is ready.
+     * errno is set to the error of the connect if it fails
+     */
+    static bool connectSucceeded(int fd) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+            return false;
+
+        errno = err;
+        return err == 0;
+    }
+
+
+    /*
+     * Helper function to start the attempts of the connect race that are due, and to wake up for the next
+     * one with a timer. The attempts are watched by the event loop until they connect or fail
+     */
+    void startAttempts() {
+        int sockfd;
+        while ((sockfd = race->startNext()) != -1) {
+            if (race->won()) {
+                onConnected();
+                return;
+            }
+
+            loop.add(sockfd, EPOLLOUT, [this, sockfd](uint32_t events) { onAttemptEvent(sockfd, events); });
+        }
+
+        if (race->failed()) {
+            int err = race->lastError();
+            fail("cannot connect to host " + hostname + ": " + strerror(err));
+            return;
+        }
+
+        auto delay = race->nextStartIn();
+        if (delay.count() >= 0)
+            startTimer(attemptTimer, std::max(delay, std::chrono::milliseconds(1)), [this]() { startAttempts(); });
+    }
+
+
+    void onAttemptEvent(int sockfd, uint32_t events) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return;
+
+        loop.remove(sockfd);
+        if (race->check(sockfd))
+            onConnected();
+        else
+            startAttempts();
+    }
+
+
+    /*
+     * Helper function to take the winner of the connect race as control connection and wait for the greeting
+     */
+    void onConnected() {
+        cancelTimer(attemptTimer);
+        for (int sockfd : race->attempts())
+            loop.remove(sockfd);
+
+        size_t winner;
+        ctrlSockfd = race->take(winner);
+        peer = addresses[winner];
+        race.reset();
+
+        state = GREETING;
+        cancelTimer(connectTimer);
+        touch();
+        ctrlEvents = EPOLLIN;
+        loop.add(ctrlSockfd, ctrlEvents, [this](uint32_t events) { onCtrlEvent(events); });
+        logDateTime(*logger) << "Opened control connection with host " << hostname << " port " << port << std::endl;
+    }
+
+
+    void onCtrlEvent(uint32_t events) {
+        if (events & EPOLLOUT)
+            flushCtrl();
+
+        if (ctrlSockfd != -1 && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            readCtrl();
+    }
+
+
+    /*
+     * Helper function to read whatever the server sent on the control connection and run the state
+     * machine for every complete reply
+     */
+    void readCtrl() {
+        bool closedByServer = false;
+        while (true) {
+            size_t available;
+            char *buf = ctrlFramer.prepare(CTRL_READ_SIZE, available);
+            auto rn = recv(ctrlSockfd, buf, available, 0);
+            if (rn == -1 && errno == EINTR)
+                continue;
+
+            if (rn == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            if (rn == -1) {
+                fail(strerror(errno));
+                return;
+            }
+
+            if (rn == 0) {
+                closedByServer = true;
+                break;
+            }
+
+            ctrlFramer.commit(static_cast<size_t>(rn));
+            touch();
+        }
+
+        while (state != FAILED && state != CLOSED && ctrlFramer.next()) {
+            FtpReplyLine text = ctrlFramer.text();
+            FtpCtrlReply reply;
+            reply.msg.assign(text.data, text.size);
+            reply.code       = static_cast<FtpCode>(ctrlFramer.code());
+            reply.replyClass = ctrlFramer.replyClass();
+            logDateTime(*logger) << "Received " << reply.msg << std::flush;
+
+            onReply(reply);
+        }
+
+        if (closedByServer && state != FAILED && state != CLOSED)
+            fail("connection closed by host " + hostname);
+    }
+
+
+    /*
+     * Helper function to move the session to the next state on the reply of the server
+     */
+    void onReply(const FtpCtrlReply &reply) {
+        // preliminary replies only tell that the transfer is starting
+        if (reply.replyClass == POSITIVE_PRELIMINARY) {
+            if (state == RETR_SENT)
+                state = TRANSFERRING;
+            return;
+        }
+
+        switch (state) {
+        case GREETING:
+            if (reply.code != SERVICE_READY) {
+                fail(trimString(reply.msg));
+                break;
+            }
+
+            state = USER_SENT;
+            sendCommand("USER " + user + "\r\n");
+            break;
+
+        case USER_SENT:
+        case PASS_SENT:
+            if (state == USER_SENT && reply.code == USER_OK_PASSWORD_NEEDED) {
+                state = PASS_SENT;
+                sendCommand("PASS " + password + "\r\n");
+            }
+            else if (reply.code == USER_LOGGED_IN_PROCCEED) {
+                state = TYPE_SENT;
+                sendCommand("TYPE I\r\n");
+            }
+            else
+                fail(trimString(reply.msg));
+            break;
+
+        case TYPE_SENT:
+        case CWD_SENT:
+            if (reply.code != (state == TYPE_SENT ? COMMAND_OK : REQUESTED_FILE_ACTION_COMPLETED)) {
+                fail(trimString(reply.msg));
+                break;
+            }
+
+            // the retrievals start once every remote directory is changed to
+            if (nextDirectory < directories.size()) {
+                state = CWD_SENT;
+                sendCommand("CWD " + directories[nextDirectory++] + "\r\n");
+                break;
+            }
+
+            state = IDLE;
+            startNext();
+            break;
+
+        case PASV_SENT:
+            if (reply.code == ENTERING_PASSIVE_MODE || reply.code == ENTERING_EXTENDED_PASSIVE_MODE)
+                openData(reply);
+            else {
+                finalReply = reply;
+                finishRetrieval();
+            }
+            break;
+
+        case RETR_SENT:
+        case TRANSFERRING:
+            // the transfer completes when both the final reply and the end of data have arrived
+            finalReply = reply;
+            hasFinalReply = true;
+            if (reply.replyClass != POSITIVE_COMPLETION)
+                closeData();
+
+            if (dataSockfd == -1)
+                finishRetrieval();
+            break;
+
+        case QUIT_SENT:
+            closeCtrl();
+            state = CLOSED;
+            logDateTime(*logger) << "Closed control connection with host " << hostname << std::endl;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+
+    /*
+     * Helper function to start the next queued retrieval, or to quit if nothing is left and quit is requested
+     */
+    void startNext() {
+        if (state != IDLE)
+            return;
+
+        if (!retrievals.empty()) {
+            received      = 0;
+            hasFinalReply = false;
+            sinkStopped   = false;
+            dataError.clear();
+            state = PASV_SENT;
+            sendCommand(peer.first.ss_family == AF_INET6 ? "EPSV 2\r\n" : "PASV\r\n");
+        }
+        else if (quitRequested) {
+            state = QUIT_SENT;
+            sendCommand("QUIT\r\n");
+        }
+    }
+
+
+    /*
+     * Helper function to start connecting the data connection to the port of the PASV or EPSV reply.
+     * The data connection goes to the address of the control connection
+     */
+    void openData(const FtpCtrlReply &reply) {
+        uint16_t dataPort;
+        if (reply.code == ENTERING_EXTENDED_PASSIVE_MODE)
+            FtpService::parseEPSVReply(reply.msg, dataPort);
+        else {
+            std::string ipAddr;
+            FtpService::parsePASVReply(reply.msg, ipAddr, dataPort);
+        }
+
+        Address address = peer;
+        if (address.first.ss_family == AF_INET6)
+            reinterpret_cast<sockaddr_in6 *>(&address.first)->sin6_port = htons(dataPort);
+        else
+            reinterpret_cast<sockaddr_in *>(&address.first)->sin_port = htons(dataPort);
+
+        dataSockfd = connectNonBlocking(address);
+        if (dataSockfd == -1) {
+            failRetrieval(strerror(errno));
+            return;
+        }
+
+        state = DATA_CONNECTING;
+        loop.add(dataSockfd, EPOLLOUT, [this](uint32_t events) { onDataEvent(events); });
+        startTimer(connectTimer, timeouts.connect, [this]() {
+            closeData();
+            failRetrieval(TimeoutException("connecting").what());
+        });
+    }
+
+
+    void onDataEvent(uint32_t events) {
+        if (state == DATA_CONNECTING) {
+            if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+                return;
+
+            cancelTimer(connectTimer);
+            if (!connectSucceeded(dataSockfd)) {
+                std::string err = strerror(errno);
+                closeData();
+                failRetrieval(err);
+                return;
+            }
+
+            loop.modify(dataSockfd, EPOLLIN);
+            logDateTime(*logger) << "Opened passive data connection with host " << hostname << std::endl;
+
+            state = RETR_SENT;
+            transferLimit.refill();
+            startTimer(transferTimer, timeouts.transfer, [this]() { fail(TimeoutException("transferring data").what()); });
+            sendCommand("RETR " + retrievals.front().remotePath + "\r\n");
+            return;
+        }
+
+        readData();
+    }
+
+
+    /*
+     * Helper function to take the bytes out of the rate limits. If a limit is in debt, the data connection
+     * is not watched until the debt is paid. Function returns false if the retrieval pauses
+     */
+    bool takeRateLimit(size_t bytes) {
+        auto wait = transferLimit.take(bytes);
+        if (sharedLimit)
+            wait = std::max(wait, sharedLimit->take(bytes));
+
+        if (wait.count() <= 0)
+            return true;
+
+        // a timer wakes up in whole milliseconds, rounded up so the debt is paid when it fires
+        auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(wait + std::chrono::milliseconds(1)
+                                                                            - std::chrono::nanoseconds(1));
+        loop.remove(dataSockfd);
+        startTimer(pauseTimer, waitMs, [this]() {
+            touch();
+            loop.add(dataSockfd, EPOLLIN, [this](uint32_t events) { onDataEvent(events); });
+        });
+        return false;
+    }
+
+
+    /*
+     * Helper function to pass whatever arrived on the data connection to the sink of the retrieval
+     */
+    void readData() {
+        for (int chunks = 0; dataSockfd != -1 && chunks < DATA_CHUNKS_PER_EVENT; ++chunks) {
+            auto rn = recv(dataSockfd, dataChunk.data(), dataChunk.size(), 0);
+            if (rn == -1 && errno == EINTR)
+                continue;
+
+            if (rn == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+
+            if (rn == -1)
+                dataError = strerror(errno);
+
+            if (rn <= 0) {
+                closeData();
+                break;
+            }
+
+            received += static_cast<uint64_t>(rn);
+            touch();
+            if (!retrievals.front().sink(dataChunk.data(), static_cast<size_t>(rn))) {
+                sinkStopped = true;
+                closeData();
+            }
+            else if (!takeRateLimit(static_cast<size_t>(rn)))
+                return;
+        }
+
+        if (dataSockfd == -1 && hasFinalReply)
+            finishRetrieval();
+    }
+
+
+    /*
+     * Helper function to complete the current retrieval when the data connection cannot be opened
+     */
+    void failRetrieval(const std::string &err) {
+        finalReply.code       = static_cast<FtpCode>(0);
+        finalReply.replyClass = INVALID_REPLY;
+        finalReply.msg        = err;
+        finishRetrieval();
+    }
+
+
+    /*
+     * Helper function to report the current retrieval to its completion and go on with the next one
+     */
+    void finishRetrieval() {
+        cancelTimer(transferTimer);
+        bool done = hasFinalReply && finalReply.replyClass == POSITIVE_COMPLETION && !sinkStopped && dataError.empty();
+        if (!dataError.empty())
+            finalReply.msg = dataError;
+
+        logDateTime(*logger) << "Received " << received << " bytes from host " << hostname << " through data connection" << std::endl;
+
+        // completion may queue more retrievals, which start once the session is idle again
+        auto retrieval = std::move(retrievals.front());
+        retrievals.pop_front();
+        retrieval.completion(done, finalReply, received);
+
+        if (state == FAILED || state == CLOSED)
+            return;
+
+        state = IDLE;
+        startNext();
+    }
+
+
+    /*
+     * Helper function to queue the command and send as much of it as the socket takes now
+     */
+    void sendCommand(const std::string &cmd) {
+        ctrlOut += cmd;
+        logDateTime(*logger) << "Sent " << cmd;
+        touch();
+        flushCtrl();
+    }
+
+
+    void flushCtrl() {
+        while (!ctrlOut.empty()) {
+            auto wn = send(ctrlSockfd, ctrlOut.data(), ctrlOut.size(), MSG_NOSIGNAL);
+            if (wn == -1 && errno == EINTR)
+                continue;
+
+            if (wn == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                watchCtrl(EPOLLIN | EPOLLOUT);
+                return;
+            }
+
+            if (wn == -1) {
+                fail(strerror(errno));
+                return;
+            }
+
+            ctrlOut.erase(0, static_cast<size_t>(wn));
+            touch();
+        }
+
+        watchCtrl(EPOLLIN);
+    }
+
+
+    void watchCtrl(uint32_t events) {
+        if (ctrlEvents == events)
+            return;
+
+        loop.modify(ctrlSockfd, events);
+        ctrlEvents = events;
+    }
+
+
+    /*
+     * Helper function to close every connection and fail the queued retrievals
+     */
+    void fail(const std::string &err) {
+        if (state == FAILED || state == CLOSED)
+            return;
+
+        error = err;
+        state = FAILED;
+        closeData();
+        closeCtrl();
+        logDateTime(*logger) << "Session with host " << hostname << " failed: " << err << std::endl;
+
+        FtpCtrlReply reply;
+        reply.code       = static_cast<FtpCode>(0);
+        reply.replyClass = INVALID_REPLY;
+        reply.msg        = err;
+
+        auto pending = std::move(retrievals);
+        retrievals.clear();
+        for (auto &retrieval : pending) {
+            retrieval.completion(false, reply, received);
+            received = 0;
+        }
+    }
+
+
+    /*
+     * Helper function to close the control connection, or the connect race before it. The timers go with it, so that the event loop
+     * does not wait on them for a session that is over
+     */
+    void closeCtrl() {
+        cancelTimers();
+        if (race) {
+            for (int sockfd : race->attempts())
+                loop.remove(sockfd);
+            race.reset();
+        }
+
+        if (ctrlSockfd == -1)
+            return;
+
+        loop.remove(ctrlSockfd);
+        close(ctrlSockfd);
+        ctrlSockfd = -1;
+        ctrlEvents = 0;
+        ctrlOut.clear();
+    }
+
+
+    void closeData() {
+        cancelTimer(pauseTimer);
+        if (dataSockfd == -1)
+            return;
+
+        loop.remove(dataSockfd);
+        close(dataSockfd);
+        dataSockfd = -1;
+    }
+
+
+    EventLoop &loop;
+    std::ostream *logger;
+    FtpTimeouts timeouts;
+    std::chrono::milliseconds connectAttemptDelay;
+    TokenBucket transferLimit;
+    std::shared_ptr<TokenBucket> sharedLimit;
+    EventLoop::TimerId connectTimer = 0;
+    EventLoop::TimerId idleTimer = 0;
+    EventLoop::TimerId transferTimer = 0;
+    EventLoop::TimerId pauseTimer = 0;
+    Clock::time_point lastActivity;
+    State state = CLOSED;
+    std::string error;
+    std::string hostname;
+    uint16_t port = 0;
+    std::string user;
+    std::string password;
+    std::vector<std::string> directories;
+    size_t nextDirectory = 0;
+    std::vector<Address> addresses;
+    std::unique_ptr<ConnectRace> race;
+    EventLoop::TimerId attemptTimer = 0;
+    Address peer;
+    int ctrlSockfd = -1;
+    uint32_t ctrlEvents = 0;
+    FtpReplyFramer ctrlFramer;
+    std::string ctrlOut;
+    int dataSockfd = -1;
+    std::vector<Byte> dataChunk = std::vector<Byte>(DATA_CHUNK_SIZE);
+    std::deque<Retrieval> retrievals;
+    bool quitRequested = false;
+    uint64_t received = 0;
+    bool hasFinalReply = false;
+    bool sinkStopped = false;
+    std::string dataError;
+    FtpCtrlReply finalReply;
+};
+
+
+AsyncFtpSession::AsyncFtpSession(EventLoop &loop, std::ostream *log) {
+    _impl = std::make_unique<Impl>(loop, log);
+}
+
+
+AsyncFtpSession::~AsyncFtpSession() {
+    _impl->closeData();
+    _impl->closeCtrl();
+}
+
+
+void AsyncFtpSession::setTimeouts(const FtpTimeouts &timeouts) {
+    _impl->timeouts = timeouts;
+}
+
+
+void AsyncFtpSession::setConnectAttemptDelay(std::chrono::milliseconds delay) {
+    _impl->connectAttemptDelay = delay;
+}
+
+
+void AsyncFtpSession::setTransferRateLimit(uint64_t rate, uint64_t burst) {
+    _impl->transferLimit.setRate(rate, burst);
+}
+
+
+void AsyncFtpSession::setSharedRateLimit(std::shared_ptr<TokenBucket> limit) {
+    _impl->sharedLimit = std::move(limit);
+}
+
+
+void AsyncFtpSession::setDirectories(const std::vector<std::string> &directories) {
+    _impl->directories = directories;
+}
+
+
+void AsyncFtpSession::open(const std::string &hostname, uint16_t port, const std::string &user, const std::string &password) {
+    _impl->hostname = hostname;
+    _impl->port     = port;
+    _impl->user     = user;
+    _impl->password = password;
+
+    // resolve every address of the host once, they all take part in the connect race
+    _impl->addresses = resolveHost(hostname, std::to_string(port));
+    _impl->race = std::make_unique<ConnectRace>(_impl->addresses, _impl->connectAttemptDelay, nullptr);
+    _impl->nextDirectory = 0;
+    _impl->state = CONNECTING;
+    _impl->startTimer(_impl->connectTimer, _impl->timeouts.connect, [this]() { _impl->fail(TimeoutException("connecting").what()); });
+    _impl->startAttempts();
+}
+
+
+void AsyncFtpSession::retrieve(const std::string &remotePath, DataSink sink, Completion completion) {
+    if (_impl->state == FAILED || _impl->state == CLOSED) {
+        FtpCtrlReply reply;
+        reply.code       = static_cast<FtpCode>(0);
+        reply.replyClass = INVALID_REPLY;
+        reply.msg        = _impl->state == FAILED ? _impl->error : "session is closed";
+        completion(false, reply, 0);
+        return;
+    }
+
+    _impl->retrievals.push_back({remotePath, std::move(sink), std::move(completion)});
+    _impl->startNext();
+}
+
+
+void AsyncFtpSession::quit() {
+    _impl->quitRequested = true;
+    _impl->startNext();
+}
+
+
+AsyncFtpSession::State AsyncFtpSession::state() const {
+    return _impl->state;
+}
+
+
+const std::string &AsyncFtpSession::error() const {
+    return _impl->error;
+}
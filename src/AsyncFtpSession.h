@@ -0,0 +1,120 @@
+#ifndef ASYNCFTPSESSION_H
+#define ASYNCFTPSESSION_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include "FtpService.h"
+#include "EventLoop.h"
+#include "TokenBucket.h"
+
+
+/*
+ * AsyncFtpSession class
+ * A non-blocking ftp session driven by an EventLoop. The session is an explicit state machine for the
+ * connect -> login -> PASV -> RETR flow that the blocking commands run step by step, so that one thread
+ * can run many sessions at once. Retrievals are queued and run one after another on the session.
+ * Data connections are always opened in passive mode. The timeouts run as timers of the event loop,
+ * and the addresses of the server race to connect like in FtpService
+ */
+class AsyncFtpSession {
+public:
+    enum State {
+        CONNECTING,
+        GREETING,
+        USER_SENT,
+        PASS_SENT,
+        TYPE_SENT,
+        CWD_SENT,
+        IDLE,
+        PASV_SENT,
+        DATA_CONNECTING,
+        RETR_SENT,
+        TRANSFERRING,
+        QUIT_SENT,
+        CLOSED,
+        FAILED,
+    };
+
+    /*
+     * Completion is called once for every retrieval, with the final reply of the server and the number
+     * of bytes passed to the sink. It may queue more retrievals on the session
+     */
+    using Completion = std::function<void(bool done, const FtpCtrlReply &reply, uint64_t received)>;
+
+    AsyncFtpSession(EventLoop &loop, std::ostream *log);
+
+    AsyncFtpSession(const AsyncFtpSession &) = delete;
+
+    AsyncFtpSession &operator=(const AsyncFtpSession &) = delete;
+
+    ~AsyncFtpSession();
+
+    /*
+     * Set the timeouts of connect, idle read and write, and data transfer, before the session is opened.
+     * A session that times out fails with the message of TimeoutException, and a data connection that
+     * cannot connect in time fails only its retrieval. The accept timeout is not used, since data
+     * connections are always passive
+     */
+    void setTimeouts(const FtpTimeouts &timeouts);
+
+    /*
+     * Set the delay between the connect attempts to the addresses of the server, before the session is
+     * opened. It is FtpService::CONNECT_ATTEMPT_DELAY by default
+     */
+    void setConnectAttemptDelay(std::chrono::milliseconds delay);
+
+    /*
+     * Limit the rate of every retrieval in bytes per second, with bursts upto burst bytes. Rate 0 turns
+     * off the limit. Each retrieval starts with a full bucket
+     */
+    void setTransferRateLimit(uint64_t rate, uint64_t burst);
+
+    /*
+     * Share the rate limit with other sessions and ftp services, so that their transfers together stay
+     * under it. A retrieval over the limit stops reading its data connection until the debt is paid,
+     * without blocking the event loop
+     */
+    void setSharedRateLimit(std::shared_ptr<TokenBucket> limit);
+
+    /*
+     * Set the remote directories to change to one after another once logged in, before the session is
+     * opened. The session fails if the server refuses any of them
+     */
+    void setDirectories(const std::vector<std::string> &directories);
+
+    /*
+     * Start connecting to the ftp server and log in. Only the host name lookup blocks, everything else
+     * runs from the event loop. Throw ResolveException if the host name cannot be resolved
+     */
+    void open(const std::string &hostname, uint16_t port, const std::string &user, const std::string &password);
+
+    /*
+     * Queue the retrieval of the remote file. The data is passed to the sink as soon as it arrives;
+     * the sink returns false to stop the transfer
+     */
+    void retrieve(const std::string &remotePath, DataSink sink, Completion completion);
+
+    /*
+     * Send QUIT once every queued retrieval is completed
+     */
+    void quit();
+
+    /*
+     * Get the state of the session
+     */
+    State state() const;
+
+    /*
+     * Get the reason of the failure if the session is in FAILED state
+     */
+    const std::string &error() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+#endif // ASYNCFTPSESSION_H
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "AsyncLog.h"
+#include "Utility.h"
+
+
+static const std::chrono::milliseconds WRITER_WAIT_INTERVAL{100};
+
+
+const size_t AsyncLog::SLOT_TEXT_SIZE;
+const size_t AsyncLog::MAX_RECORD_SLOTS;
+
+
+AsyncLog::AsyncLog(std::ostream *sink, size_t capacity)
+    : _sink{sink}, _tail{0}, _head{0}, _dropped{0}, _droppedReported{0}, _waiting{false}, _stop{false}
+{
+    size_t slotCount = MAX_RECORD_SLOTS;
+    while (slotCount < capacity)
+        slotCount *= 2;
+
+    _slots.reset(new Slot[slotCount]);
+    _mask = slotCount - 1;
+    for (size_t i = 0; i < slotCount; ++i)
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+
+    _writer = std::thread(&AsyncLog::run, this);
+}
+
+
+AsyncLog::~AsyncLog() {
+    _stop.store(true);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _wakeup.notify_one();
+    }
+
+    _writer.join();
+}
+
+
+bool AsyncLog::push(std::time_t time, const char *text, size_t size) {
+    size_t count = std::max<size_t>(1, (size + SLOT_TEXT_SIZE - 1) / SLOT_TEXT_SIZE);
+    if (count > MAX_RECORD_SLOTS) {
+        count = MAX_RECORD_SLOTS;
+        size  = MAX_RECORD_SLOTS * SLOT_TEXT_SIZE;
+    }
+
+    // claim count consecutive slots at once. The writer frees the slots in order, so the whole run is
+    // free once its last slot is
+    uint64_t pos = _tail.load(std::memory_order_relaxed);
+    while (true) {
+        uint64_t last = pos + count - 1;
+        uint64_t sequence = _slots[last & _mask].sequence.load(std::memory_order_acquire);
+        if (sequence == last) {
+            if (_tail.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                break;
+        }
+        else if (sequence < last) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+            pos = _tail.load(std::memory_order_relaxed);
+    }
+
+    // publish the slots one by one, the writer takes the record once every slot of it is published
+    for (size_t i = 0; i < count; ++i) {
+        Slot &slot = _slots[(pos + i) & _mask];
+        size_t textSize = std::min(size, SLOT_TEXT_SIZE);
+        slot.time  = time;
+        slot.count = static_cast<uint16_t>(count - i);
+        slot.size  = static_cast<uint16_t>(textSize);
+        memcpy(slot.text, text, textSize);
+        text += textSize;
+        size -= textSize;
+        slot.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+
+    // only the first record after the writer went to sleep wakes it up. A wakeup lost in the race with
+    // the writer going to sleep is caught up by its wait interval
+    if (_waiting.load(std::memory_order_relaxed) && _waiting.exchange(false))
+        _wakeup.notify_one();
+
+    return true;
+}
+
+
+uint64_t AsyncLog::dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+
+bool AsyncLog::pop(std::string &batch) {
+    Slot &first = _slots[_head & _mask];
+    if (first.sequence.load(std::memory_order_acquire) != _head + 1)
+        return false;
+
+    size_t count = first.count;
+    for (size_t i = 1; i < count; ++i) {
+        if (_slots[(_head + i) & _mask].sequence.load(std::memory_order_acquire) != _head + i + 1)
+            return false;
+    }
+
+    if (first.time != 0)
+        batch += logTimePrefix(first.time);
+
+    for (size_t i = 0; i < count; ++i) {
+        Slot &slot = _slots[(_head + i) & _mask];
+        batch.append(slot.text, slot.size);
+        slot.sequence.store(_head + i + _mask + 1, std::memory_order_release);
+    }
+
+    _head += count;
+    return true;
+}
+
+
+void AsyncLog::run() {
+    std::string batch;
+    while (true) {
+        // records pushed before the stop are still written
+        bool stop = _stop.load();
+        while (pop(batch)) {}
+
+        uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+        if (dropped != _droppedReported) {
+            batch += logTimePrefix(std::time(nullptr)) + "Dropped " + std::to_string(dropped - _droppedReported)
+                   + " log records\n";
+            _droppedReported = dropped;
+        }
+
+        if (!batch.empty()) {
+            _sink->write(batch.data(), static_cast<std::streamsize>(batch.size()));
+            _sink->flush();
+            batch.clear();
+            continue;
+        }
+
+        if (stop)
+            break;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _waiting.store(true);
+        // a record whose first slot is published is still being copied and is taken on the next round
+        Slot &next = _slots[_head & _mask];
+        if (next.sequence.load(std::memory_order_acquire) == _head + 1)
+            std::this_thread::yield();
+        else if (!_stop.load())
+            _wakeup.wait_for(lock, WRITER_WAIT_INTERVAL);
+
+        _waiting.store(false);
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * AsyncLog class
+ * Log backend that takes the writes off the threads that log. Records are copied into a fixed size
+ * ring buffer of slots without any lock, and a background thread formats their timestamps and writes
+ * them to the sink in batches. Logging never waits for the sink: if the ring is full, the record is
+ * dropped and counted, and the number of dropped records is written to the log later. Every thread
+ * may push records at the same time
+ */
+class AsyncLog {
+public:
+    /*
+     * Text bytes held by one slot. Longer records take consecutive slots
+     */
+    static const size_t SLOT_TEXT_SIZE = 232;
+
+    /*
+     * Most slots one record can take. Longer records are cut
+     */
+    static const size_t MAX_RECORD_SLOTS = 64;
+
+    /*
+     * Create the log writing to the sink with a ring of capacity slots, which is rounded up to a power of 2
+     */
+    AsyncLog(std::ostream *sink, size_t capacity);
+
+    AsyncLog(const AsyncLog &) = delete;
+
+    AsyncLog &operator=(const AsyncLog &) = delete;
+
+    /*
+     * Write every record pushed so far and stop the background thread
+     */
+    ~AsyncLog();
+
+    /*
+     * Push the record. If time is not 0, the record is written after the log time prefix of that second.
+     * Function returns false if the ring is full and the record is dropped
+     */
+    bool push(std::time_t time, const char *text, size_t size);
+
+    /*
+     * Get the number of records dropped since the log was created
+     */
+    uint64_t dropped() const;
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        std::time_t time;
+        uint16_t size;
+        uint16_t count;
+        char text[SLOT_TEXT_SIZE];
+    };
+
+    /*
+     * Helper function to take the next complete record out of the ring and append it to the batch.
+     * Function returns false if the ring is empty or the next record is still being copied
+     */
+    bool pop(std::string &batch);
+
+    /*
+     * Helper function of the background thread to write the records until the log is stopped
+     */
+    void run();
+
+    std::ostream *_sink;
+    std::unique_ptr<Slot[]> _slots;
+    size_t _mask;
+    std::atomic<uint64_t> _tail;
+    uint64_t _head;
+    std::atomic<uint64_t> _dropped;
+    uint64_t _droppedReported;
+    std::atomic<bool> _waiting;
+    std::atomic<bool> _stop;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::thread _writer;
+};
+
+#endif // ASYNCLOG_H
@@ -1,9 +1,27 @@
 #include <iostream>
 #include <iomanip>
-#include <fstream>
+#include <sstream>
 #include <map>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cctype>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "Cmd.h"
 #include "Utility.h"
+#include "TransferJournal.h"
+#include "PartialFile.h"
+#include "AsyncLog.h"
+
+
+static const std::chrono::milliseconds PROGRESS_INTERVAL{500};
+static const size_t LOG_CAPACITY = 8192;
 
 /************************************************************
  * CommandService class definition
@@ -32,16 +50,142 @@ struct CommandService::Impl {
     }
 
 
+    /*
+     * Helper function to draw the progress of the transfer over the same line of a terminal. Transfers that
+     * are done before the first report, such as most directory listings, draw nothing
+     */
+    void renderProgress(const TransferProgress &progress) {
+        static const double MIB = 1024 * 1024;
+
+        if (progress.done && !progressDrawn)
+            return;
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(2) << progress.transferred / MIB << " MiB";
+        if (progress.total != 0)
+            line << " of " << progress.total / MIB << " MiB (" << std::setprecision(0) << 100.0 * progress.transferred / progress.total << "%)";
+
+        line << std::setprecision(2) << ", " << progress.currentRate / MIB << " MiB/s now, " << progress.averageRate / MIB << " MiB/s average";
+        if (!progress.done && progress.eta >= 0) {
+            auto eta = static_cast<uint64_t>(progress.eta);
+            line << ", ETA " << eta / 3600 << ":" << std::setfill('0') << std::setw(2) << eta / 60 % 60 << ":" << std::setw(2) << eta % 60;
+        }
+
+        // blank out what is left of a longer line drawn before
+        std::string text = line.str();
+        size_t drawnSize = text.size();
+        if (text.size() < progressLineSize)
+            text.append(progressLineSize - text.size(), ' ');
+
+        *output << "\r" << text << (progress.done ? "\n" : "") << std::flush;
+        progressLineSize = progress.done ? 0 : drawnSize;
+        progressDrawn    = !progress.done;
+    }
+
+
+    /*
+     * Helper function to log in again after the control connection is lost, and bring the session back to
+     * the remote directory, representation type and transfer mode it had. What the server refuses to restore
+     * is told to the user
+     */
+    bool relogin(TransferMode mode, char type) {
+        if (user.empty())
+            return false;
+
+        try {
+            FtpCtrlReply reply;
+            ftpService->openCtrlConnect(hostname, port);
+            ftpService->readCtrlReply(reply);
+            if (reply.code != SERVICE_READY) {
+                ftpService->closeCtrlConnect();
+                return false;
+            }
+
+            ftpService->sendUSER(user);
+            ftpService->readCtrlReply(reply);
+            if (reply.code == USER_OK_PASSWORD_NEEDED) {
+                ftpService->sendPASS(password);
+                ftpService->readCtrlReply(reply);
+            }
+
+            if (reply.code != USER_LOGGED_IN_PROCCEED) {
+                ftpService->closeCtrlConnect();
+                return false;
+            }
+
+            restoreSession(mode, type);
+            return true;
+        } catch (const SocketException &) {
+            ftpService->closeCtrlConnect();
+            return false;
+        }
+    }
+
+
+    /*
+     * Helper function to replay the remembered directory changes on the control connection of the ftp service.
+     * Function returns false with the directory the server refuses
+     */
+    bool changeDirectories(FtpService &ftp, std::string &refused) {
+        FtpCtrlReply reply;
+        for (const auto &directory : directories) {
+            ftp.sendCWD(directory);
+            ftp.readCtrlReply(reply);
+            if (reply.code != REQUESTED_FILE_ACTION_COMPLETED) {
+                refused = directory;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    /*
+     * Helper function to replay the directory changes, TYPE and MODE of the session on a new control connection
+     */
+    void restoreSession(TransferMode mode, char type) {
+        std::string directory;
+        if (!changeDirectories(*ftpService, directory))
+            *output << "Cannot change to remote directory " << directory << " again\n";
+
+        FtpCtrlReply reply;
+        if (type != ftpService->transferType()) {
+            ftpService->sendTYPE(type);
+            ftpService->readCtrlReply(reply);
+            if (reply.code == COMMAND_OK)
+                ftpService->setTransferType(type);
+        }
+
+        if (mode != ftpService->transferMode()) {
+            ftpService->sendMODE(mode);
+            ftpService->readCtrlReply(reply);
+            if (reply.code == COMMAND_OK)
+                ftpService->setTransferMode(mode);
+            else
+                *output << "Server refuses MODE " << static_cast<char>(mode) << " again. Use stream mode\n";
+        }
+    }
+
+
     bool passiveMode;
+    bool showProgress;
+    bool progressDrawn;
+    size_t progressLineSize;
     bool serviceAvailable;
     bool shouldTerminate;
     std::string hostname;
     uint16_t port;
-    std::unique_ptr<FtpService> ftpService;
-    std::map<std::string, std::unique_ptr<Command>> commands;
+    std::string user;
+    std::string password;
+    std::vector<std::string> directories;
     std::ostream *output;
     std::istream *input;
-    std::ostream *logger;
+    std::unique_ptr<AsyncLog> log;
+    std::unique_ptr<LogStream> logger;
+    std::unique_ptr<FtpService> ftpService;
+    std::unique_ptr<SessionPool> sessionPool;
+    std::map<std::string, std::unique_ptr<Command>> commands;
 };
 
 
@@ -56,8 +200,13 @@ CommandService::CommandService(std::ostream *output, std::istream *input, std::o
     _impl->port = port;
     _impl->output = output;
     _impl->input = input;
-    _impl->logger = logger;
-    _impl->ftpService  = std::make_unique<FtpService>(logger);
+    _impl->log    = std::make_unique<AsyncLog>(logger, LOG_CAPACITY);
+    _impl->logger = std::make_unique<LogStream>(_impl->log.get());
+    _impl->ftpService  = std::make_unique<FtpService>(_impl->logger.get());
+    _impl->ftpService->setSharedRateLimit(std::make_shared<TokenBucket>());
+    _impl->progressDrawn = false;
+    _impl->progressLineSize = 0;
+    setShowProgress(output == &std::cout && isatty(STDOUT_FILENO));
 
     // initialize commands
     _impl->commands.insert({      HelpCommand::PROG, std::make_unique<HelpCommand>(_impl->ftpService.get(), this)});
@@ -68,19 +217,110 @@ CommandService::CommandService(std::ostream *output, std::istream *input, std::o
     _impl->commands.insert({       PwdCommand::PROG, std::make_unique<PwdCommand>(_impl->ftpService.get(), this)});
     _impl->commands.insert({        LsCommand::PROG, std::make_unique<LsCommand>(_impl->ftpService.get(), this)});
     _impl->commands.insert({       GetCommand::PROG, std::make_unique<GetCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({      MgetCommand::PROG, std::make_unique<MgetCommand>(_impl->ftpService.get(), this)});
     _impl->commands.insert({       PutCommand::PROG, std::make_unique<PutCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({      SizeCommand::PROG, std::make_unique<SizeCommand>(_impl->ftpService.get(), this)});
     _impl->commands.insert({   PassiveCommand::PROG, std::make_unique<PassiveCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({     UringCommand::PROG, std::make_unique<UringCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({  CompressCommand::PROG, std::make_unique<CompressCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({     BlockCommand::PROG, std::make_unique<BlockCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({  PasvAddrCommand::PROG, std::make_unique<PasvAddrCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({ PortRangeCommand::PROG, std::make_unique<PortRangeCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({  ListenerCommand::PROG, std::make_unique<ListenerCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({      TuneCommand::PROG, std::make_unique<TuneCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({   TimeoutCommand::PROG, std::make_unique<TimeoutCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({      RateCommand::PROG, std::make_unique<RateCommand>(_impl->ftpService.get(), this)});
+    _impl->commands.insert({  ProgressCommand::PROG, std::make_unique<ProgressCommand>(_impl->ftpService.get(), this)});
 }
 
 
 CommandService::~CommandService() {}
 
 
+void CommandService::setCredentials(const std::string &user, const std::string &password) {
+    _impl->user = user;
+    _impl->password = password;
+    _impl->directories.clear();
+}
+
+
+void CommandService::rememberDirectory(const std::string &path) {
+    if (!path.empty() && path[0] == '/')
+        _impl->directories.clear();
+
+    _impl->directories.push_back(path);
+}
+
+
+std::unique_ptr<FtpSession> CommandService::openSession() {
+    auto session = std::make_unique<FtpSession>(_impl->log.get());
+    session->ftp().setUseAdvertisedAddress(_impl->ftpService->useAdvertisedAddress());
+    session->ftp().setSocketOptions(_impl->ftpService->socketOptions());
+    session->ftp().setTimeouts(_impl->ftpService->timeouts());
+    session->ftp().setSharedRateLimit(_impl->ftpService->sharedRateLimit());
+
+    const auto &transferLimit = _impl->ftpService->transferRateLimit();
+    session->ftp().setTransferRateLimit(transferLimit.rate(), transferLimit.burst());
+    if (!session->login(_impl->hostname, _impl->port, _impl->user, _impl->password))
+        return nullptr;
+
+    // the session works on the same remote paths as the interactive one
+    std::string refused;
+    if (!_impl->changeDirectories(session->ftp(), refused))
+        return nullptr;
+
+    return session;
+}
+
+
+std::unique_ptr<AsyncFtpSession> CommandService::openAsyncSession(EventLoop &loop) {
+    auto session = std::make_unique<AsyncFtpSession>(loop, _impl->logger.get());
+    session->setTimeouts(_impl->ftpService->timeouts());
+    session->setConnectAttemptDelay(_impl->ftpService->connectAttemptDelay());
+    session->setSharedRateLimit(_impl->ftpService->sharedRateLimit());
+
+    const auto &transferLimit = _impl->ftpService->transferRateLimit();
+    session->setTransferRateLimit(transferLimit.rate(), transferLimit.burst());
+    session->setDirectories(_impl->directories);
+    session->open(_impl->hostname, _impl->port, _impl->user, _impl->password);
+    return session;
+}
+
+
+SessionPool &CommandService::sessionPool(size_t sessions) {
+    if (!_impl->sessionPool)
+        _impl->sessionPool = std::make_unique<SessionPool>([this]() { return openSession(); }, sessions);
+    else
+        _impl->sessionPool->grow(sessions);
+
+    return *_impl->sessionPool;
+}
+
+
+void CommandService::closeSessionPool() {
+    _impl->sessionPool.reset();
+}
+
+
 void CommandService::setPassiveMode(bool passive) {
     _impl->passiveMode = passive;
 }
 
 
+bool CommandService::showProgress() const {
+    return _impl->showProgress;
+}
+
+
+void CommandService::setShowProgress(bool show) {
+    _impl->showProgress = show;
+    if (show)
+        _impl->ftpService->setProgressCallback([this](const TransferProgress &progress) { _impl->renderProgress(progress); }, PROGRESS_INTERVAL);
+    else
+        _impl->ftpService->setProgressCallback(nullptr, PROGRESS_INTERVAL);
+}
+
+
 bool CommandService::serviceShouldTerminate() const {
     return _impl->shouldTerminate;
 }
@@ -153,13 +393,32 @@ void CommandService::run() {
                 try {
                     cmd->second->execute(argvs);
                 } catch (const std::exception &e) {
-                    *_impl->output << "Oops fatal error occur: " << e.what() << "\n"
-                                   << "Close ftp connection\n";
-
-                    logDateTime(*_impl->logger) << "Fatal error occur: " << e.what() << ". Close ftp connection" << std::endl;
-
+                    // a timed out operation leaves the control connection out of sync as well
+                    if (dynamic_cast<const TimeoutException *>(&e)) {
+                        *_impl->output << e.what() << "\n"
+                                       << "Reconnect to ftp server\n";
+
+                        logDateTime(*_impl->logger) << e.what() << ". Reconnect to ftp server" << std::endl;
+                    }
+                    else {
+                        *_impl->output << "Oops fatal error occur: " << e.what() << "\n"
+                                       << "Reconnect to ftp server\n";
+
+                        logDateTime(*_impl->logger) << "Fatal error occur: " << e.what() << ". Reconnect to ftp server" << std::endl;
+                    }
+
+                    // the pool replaces its own broken sessions, only the interactive session is logged in again
+                    TransferMode mode = _impl->ftpService->transferMode();
+                    char type = _impl->ftpService->transferType();
                     _impl->ftpService->closeCtrlConnect();
-                    setServiceAvailable(false);
+                    if (_impl->relogin(mode, type)) {
+                        *_impl->output << "Logged in again as " << _impl->user << "\n";
+                    }
+                    else {
+                        *_impl->output << "Cannot log in again. Close ftp connection\n";
+                        closeSessionPool();
+                        setServiceAvailable(false);
+                    }
                 }
             }
         }
@@ -189,6 +448,7 @@ struct Command::Impl {
         auto &logger = cmdService->logger();
 
         uint16_t passivePort;
+        std::string ipAddr;
         FtpCtrlReply reply;
         int retries = 1;
         while (retries <= RETRIES) {
@@ -206,13 +466,15 @@ struct Command::Impl {
                 if (reply.code != ENTERING_PASSIVE_MODE)
                     break;
 
-                std::string ipAddr;
                 FtpService::parsePASVReply(reply.msg, ipAddr, passivePort);
             }
 
             try {
-                cmd->ftpService->openDataConnect(passivePort, false);
+                cmd->ftpService->openPassiveDataConnect(ipAddr, passivePort);
                 break;
+            } catch (const TimeoutException &) {
+                // the server is not reachable, retries would only multiply the wait
+                throw;
             } catch (const SocketException &e) {
                 output << "Failed to open data connection on local: " << e.what() << ". Retries: " << retries << "/" << RETRIES << "\n";
                 logDateTime(logger) << "Failed to open data connection on local: " << e.what() << ". Retries: " << retries << "/" << RETRIES << std::endl;
@@ -229,29 +491,29 @@ struct Command::Impl {
         auto &output = cmdService->output();
         auto &logger = cmdService->logger();
 
-        FtpCtrlReply reply;
-        uint16_t port = FtpService::USABLE_PORT_MAX;
-        while (port >= FtpService::USABLE_PORT_MIN) {
-            if (cmd->ftpService->netProtocol() == IPv6)
-                cmd->ftpService->sendEPRT(IPv6, port);
-            else
-                cmd->ftpService->sendPORT(port);
-
-            cmd->getFtpReplyAndCheckTimeout(reply);
-            if (reply.code != COMMAND_OK)
-                break;
+        // listen first, so the server is told a port that is known to be free
+        uint16_t port;
+        try {
+            cmd->ftpService->openActiveDataConnect(port);
+        } catch (const SocketException &e) {
+            output << "Failed to open data connection on local: " << e.what() << "\n";
+            logDateTime(logger) << "Failed to open data connection on local: " << e.what() << std::endl;
+            return false;
+        }
 
-            try {
-                cmd->ftpService->openDataConnect(port, true);
-                break;
-            } catch (const SocketException &e) {
-                --port;
-                output << "Failed to open data connection on local: " << e.what() << ". Retry another port number: " << port << "\n";
-                logDateTime(logger) << "Failed to open data connection on local: " << e.what() << ". Retry another port number: " << port << std::endl;
-            }
+        FtpCtrlReply reply;
+        if (cmd->ftpService->netProtocol() == IPv6)
+            cmd->ftpService->sendEPRT(IPv6, port);
+        else
+            cmd->ftpService->sendPORT(port);
+
+        cmd->getFtpReplyAndCheckTimeout(reply);
+        if (reply.code != COMMAND_OK) {
+            cmd->ftpService->shutdownDataConnect();
+            return false;
         }
 
-        return port >= FtpService::USABLE_PORT_MIN && reply.code == COMMAND_OK;
+        return true;
     }
 
     Command *cmd;
@@ -271,6 +533,10 @@ Command::~Command()
 
 
 bool Command::openDataConnection() {
+    // block mode data connection of the last transfer carries the next one
+    if (ftpService->dataConnectOpen())
+        return true;
+
     if (cmdService->passiveMode())
         return _impl->openPassiveDataConnection();
 
@@ -278,6 +544,16 @@ bool Command::openDataConnection() {
 }
 
 
+bool Command::getRemoteSize(const std::string &remotePath, uint64_t &size) {
+    FtpCtrlReply reply;
+    ftpService->sendSIZE(remotePath);
+    getFtpReplyAndCheckTimeout(reply);
+
+    // reply looks like "213 <size>\r\n"
+    return reply.code == FILE_STATUS && toUnsignedInt(trimString(reply.msg.substr(4)), size) == 0;
+}
+
+
 bool Command::checkCmdServiceAvailable() {
     auto &output = cmdService->output();
     bool available = cmdService->serviceAvailable();
@@ -391,6 +667,8 @@ void ConnectCommand::execute(const std::vector<std::string> &) {
     getline(input, pass);
     ftpService->sendPASS(pass);
     getFtpReplyAndCheckTimeout(reply);
+    if (reply.code == USER_LOGGED_IN_PROCCEED)
+        cmdService->setCredentials(user, pass);
 }
 
 
@@ -412,6 +690,7 @@ void DisconnectCommand::execute(const std::vector<std::string> &) {
         return;
 
     FtpCtrlReply reply;
+    cmdService->closeSessionPool();
     ftpService->sendQUIT();
     getFtpReply(reply);
     ftpService->closeCtrlConnect();
@@ -437,6 +716,7 @@ void QuitCommand::execute(const std::vector<std::string> &) {
 
     if (cmdService->serviceAvailable()) {
         FtpCtrlReply reply;
+        cmdService->closeSessionPool();
         ftpService->sendQUIT();
         getFtpReply(reply);
         ftpService->closeCtrlConnect();
@@ -471,6 +751,11 @@ void CdCommand::execute(const std::vector<std::string> &argvs) {
     FtpCtrlReply reply;
     ftpService->sendCWD(remotePath);
     getFtpReplyAndCheckTimeout(reply);
+    // pooled sessions are in the old directory, so they are logged in again when next needed
+    if (reply.code == REQUESTED_FILE_ACTION_COMPLETED) {
+        cmdService->rememberDirectory(remotePath);
+        cmdService->closeSessionPool();
+    }
 }
 
 
@@ -528,7 +813,9 @@ void LsCommand::execute(const std::vector<std::string> &argvs) {
     // send LIST cmd
     ftpService->sendLIST(remotePath);
     getFtpReplyAndCheckTimeout(reply);
-    if (reply.code != FILE_STATUS_OK_OPEN_DATA_CONNECTION) {
+
+    // 150 opens the data connection, 125 starts the transfer on the one kept open in block mode
+    if (reply.replyClass != POSITIVE_PRELIMINARY) {
         ftpService->closeDataConnect();
         return;
     }
@@ -553,8 +840,12 @@ const std::string GetCommand::PROG = "get";
 
 void GetCommand::displayHelp() {
     auto &output = cmdService->output();
-    output << "Usage : Download the remote file and save it into the local file. Local file is optional and default to be the name of remote file\n";
-    output << "Syntax: get <Space> <Remote File> [<Space> <Local File>] <Enter>\n";
+    output << "Usage : Download the remote file and save it into the local file. Local file is optional and default to be the name of remote file. "
+              "With -s, the file is downloaded in the given number of segments in parallel, each over its own passive connection. "
+              "The file is downloaded to <Local File>.part, which replaces the local file once the download completes. "
+              "An interrupted download is resumed from the end of the partial file if its journal is found. With -c, it is resumed even without journal, "
+              "from the end of the local file if there is no partial file\n";
+    output << "Syntax: get [<Space> -s <Space> <Segments>] [<Space> -c] <Space> <Remote File> [<Space> <Local File>] <Enter>\n";
 }
 
 
@@ -562,7 +853,24 @@ void GetCommand::execute(const std::vector<std::string> &argvs) {
     if (!checkCmdServiceAvailable())
         return;
 
-    if (argvs.size() < 2) {
+    // parse options and paths
+    unsigned segments = 1;
+    bool resume = false;
+    std::vector<std::string> paths;
+    for (size_t i = 1; i < argvs.size(); ++i) {
+        if (argvs[i] == "-s" && i + 1 < argvs.size()) {
+            if (toUnsignedInt(argvs[++i], segments) != 0 || segments == 0) {
+                displayHelp();
+                return;
+            }
+        }
+        else if (argvs[i] == "-c")
+            resume = true;
+        else
+            paths.push_back(argvs[i]);
+    }
+
+    if (paths.empty()) {
         displayHelp();
         return;
     }
@@ -570,49 +878,479 @@ void GetCommand::execute(const std::vector<std::string> &argvs) {
     auto &output = cmdService->output();
 
     // get local and remote path
-    std::string localPath;
-    std::string remotePath;
-    if (argvs.size() == 2) {
-        remotePath = argvs[1];
-        localPath  = remotePath;
-    }
-    else {
-        remotePath  = argvs[1];
-        localPath   = argvs[2];
-    }
+    std::string remotePath = paths[0];
+    std::string localPath  = paths.size() == 1 ? remotePath : paths[1];
     output << "Local path: "  << localPath  << "\n";
     output << "Remote path: " << remotePath << "\n";
 
-    // open data connection
+    if (segments > 1) {
+        executeSegmented(remotePath, localPath, segments);
+        return;
+    }
+
+    // binary type makes SIZE and REST count the same bytes as the local file
     FtpCtrlReply reply;
-    if (!openDataConnection())
+    ftpService->sendTYPE('I');
+    getFtpReplyAndCheckTimeout(reply);
+    if (reply.code == COMMAND_OK)
+        ftpService->setTransferType('I');
+
+    // the size of the remote file identifies the download in the journal. The modification time is only asked
+    // for when it is compared: against a journal that recorded one, or for a resume. A fresh get without journal
+    // skips the round trip and its journal records the size only
+    TransferJournal journal(localPath);
+    TransferJournal::Entry entry{"get", remotePath, 0, ""}, recorded;
+    bool resumable = getRemoteSize(remotePath, entry.size);
+    bool versioned = journal.load(recorded) && !recorded.version.empty();
+    if (resumable && (resume || versioned)) {
+        ftpService->sendMDTM(remotePath);
+        getFtpReplyAndCheckTimeout(reply);
+        if (reply.code == FILE_STATUS)
+            entry.version = trimString(reply.msg.substr(4));
+    }
+
+    // the download goes to a partial file that replaces the local file once it completes, so a failed get never
+    // destroys an existing local file. The partial file is the checkpoint: whatever reached it does not need to
+    // be downloaded again
+    PartialFile file(localPath);
+    bool resuming = resumable && (resume || journal.matches(entry));
+    if (!file.open(resuming)) {
+        output << "Cannot open local path: " << file.path() << "\n";
+        return;
+    }
+
+    uint64_t offset = 0;
+    off_t localSize = file.size();
+    if (resuming && localSize > 0 && static_cast<uint64_t>(localSize) <= entry.size)
+        offset = static_cast<uint64_t>(localSize);
+    else if (localSize != 0 && !file.restart()) {
+        output << "Cannot open local path: " << file.path() << "\n";
+        return;
+    }
+
+    if (offset > 0 && offset == entry.size) {
+        output << "Local file is already complete\n";
+        if (commitDownload(file))
+            journal.remove();
+        return;
+    }
+
+    if (resumable && !journal.save(entry))
+        output << "Cannot write transfer journal: " << journal.path() << "\n";
+
+    // a fresh download leaves nothing behind if it cannot start, a resumed one keeps its progress
+    auto abandon = [&]() {
+        if (offset > 0)
+            file.keep();
+        else
+            journal.remove();
+    };
+
+    // open data connection
+    if (!openDataConnection()) {
+        abandon();
         return;
+    }
+
+    // ask the server to start from the end of the local file
+    if (offset > 0) {
+        ftpService->sendREST(offset);
+        getFtpReplyAndCheckTimeout(reply);
+        if (reply.code != REQUESTED_FILE_ACTION_PENDING_FOR_FURTHER_INFO) {
+            offset = 0;
+            if (!file.restart()) {
+                output << "Cannot open local path: " << file.path() << "\n";
+                ftpService->closeDataConnect();
+                abandon();
+                return;
+            }
+        }
+        else
+            output << "Resume download at byte " << offset << "\n";
+    }
 
     // send RETR cmd
     ftpService->sendRETR(remotePath);
     getFtpReplyAndCheckTimeout(reply);
-    if (reply.code != FILE_STATUS_OK_OPEN_DATA_CONNECTION) {
+    if (reply.replyClass != POSITIVE_PRELIMINARY) {
         ftpService->closeDataConnect();
+        abandon();
         return;
     }
 
-    // read data from data connection
-    std::vector<Byte> buf;
-    ftpService->readDataReply(buf);
+    // whatever arrives from now on can be resumed
+    if (resumable)
+        file.keep();
+
+    // let the kernel move data from data connection to the local file
+    if (resumable)
+        ftpService->setExpectedTransferSize(entry.size - offset);
+    bool written = ftpService->readDataReply(file.fd());
+    int writeError = errno;
     ftpService->closeDataConnect();
 
+    if (!written)
+        output << "Failed to write local path: " << file.path() << ": " << strerror(writeError) << "\n";
+
     // read server reply from ctrl connection
     getFtpReplyAndCheckTimeout(reply);
-    if (reply.code != CLOSE_DATA_CONNECTION_REQUEST_FILE_ACTION_SUCCESS)
+    if (written && (reply.code == CLOSE_DATA_CONNECTION_REQUEST_FILE_ACTION_SUCCESS || reply.code == REQUESTED_FILE_ACTION_COMPLETED) && commitDownload(file))
+        journal.remove();
+}
+
+
+bool GetCommand::commitDownload(PartialFile &file) {
+    if (file.commit())
+        return true;
+
+    cmdService->output() << "Cannot move " << file.path() << " to the local path\n";
+    return false;
+}
+
+
+void GetCommand::executeSegmented(const std::string &remotePath, const std::string &localPath, unsigned segments) {
+    auto &output = cmdService->output();
+
+    // the size of the remote file decides the byte range of each segment
+    FtpCtrlReply reply;
+    ftpService->sendTYPE('I');
+    getFtpReplyAndCheckTimeout(reply);
+    if (reply.code != COMMAND_OK)
         return;
 
-    // write data to file
-    std::ofstream file(localPath, std::ios::out | std::ios::binary);
-    if (!file) {
-        output << "Cannot open local path: " << localPath << "\n";
+    ftpService->setTransferType('I');
+
+    ftpService->sendSIZE(remotePath);
+    getFtpReplyAndCheckTimeout(reply);
+    uint64_t fileSize;
+    if (reply.code != FILE_STATUS || toUnsignedInt(trimString(reply.msg.substr(4)), fileSize) != 0) {
+        output << "Cannot get the size of remote path: " << remotePath << "\n";
+        return;
+    }
+
+    // segments land in a partial file, which replaces the local file once every segment is done
+    PartialFile file(localPath);
+    if (!file.open(false) || ftruncate(file.fd(), static_cast<off_t>(fileSize)) == -1) {
+        output << "Cannot open local path: " << file.path() << "\n";
+        return;
+    }
+
+    // small files do not need every segment
+    segments = static_cast<unsigned>(std::max<uint64_t>(1, std::min<uint64_t>(segments, fileSize)));
+    uint64_t segmentSize = fileSize / segments;
+
+    struct Segment {
+        uint64_t offset;
+        uint64_t length;
+        uint64_t received;
+        bool done;
+        std::string error;
+    };
+    std::vector<Segment> ranges(segments);
+    for (unsigned i = 0; i < segments; ++i) {
+        ranges[i].offset   = i * segmentSize;
+        ranges[i].length   = i + 1 == segments ? fileSize - ranges[i].offset : segmentSize;
+        ranges[i].received = 0;
+        ranges[i].done     = false;
+    }
+
+    // every segment is retrieved over its own control and data connection, borrowed from the session pool
+    auto &pool = cmdService->sessionPool(segments);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (auto &range : ranges) {
+        workers.emplace_back([&pool, &range, &remotePath, &file]() {
+            try {
+                auto session = pool.acquire();
+                if (!session) {
+                    range.error = "login refused";
+                    return;
+                }
+
+                try {
+                    if (range.length > 0)
+                        range.done = session->retrieve(remotePath, file.fd(), range.offset, range.length, range.received);
+                    else
+                        range.done = true;
+                } catch (...) {
+                    session.discard();
+                    throw;
+                }
+
+                if (!range.done)
+                    range.error = trimString(session->lastReply().msg);
+            } catch (const std::exception &e) {
+                range.error = e.what();
+            }
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // report the result of every segment and the aggregate throughput
+    uint64_t received = 0;
+    bool done = true;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        received += ranges[i].received;
+        if (!ranges[i].done) {
+            done = false;
+            output << "Segment " << i + 1 << " failed at byte " << ranges[i].offset + ranges[i].received << ": " << ranges[i].error << "\n";
+        }
+    }
+
+    if (done)
+        done = commitDownload(file);
+
+    std::ostringstream rate;
+    rate << std::fixed << std::setprecision(2) << seconds << " s, " << (seconds > 0 ? received / seconds / 1024 / 1024 : 0) << " MiB/s";
+    output << (done ? "Downloaded " : "Incomplete download: ") << received << " of " << fileSize << " bytes in " << segments << " segments, "
+           << rate.str() << "\n";
+    logDateTime(cmdService->logger()) << "Downloaded " << received << " of " << fileSize << " bytes of " << remotePath << " in "
+                                      << segments << " segments" << std::endl;
+}
+
+
+/************************************************************
+ * MgetCommand class definition
+ ************************************************************/
+const std::string MgetCommand::PROG = "mget";
+
+
+void MgetCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Download the remote files concurrently into the current local directory. Remote file may be a glob pattern, e.g. logs/*.csv. "
+              "Of the remote files with the same name, only the first is downloaded. "
+              "With -p, the files are downloaded over the given number of sessions, default is " << DEFAULT_SESSIONS << ". "
+              "With -e, all sessions run on one thread driven by epoll instead of one thread per session\n";
+    output << "Syntax: mget [<Space> -p <Space> <Sessions>] [<Space> -e] <Space> <Remote File> [<Space> <Remote File> ...] <Enter>\n";
+}
+
+
+void MgetCommand::execute(const std::vector<std::string> &argvs) {
+    if (!checkCmdServiceAvailable())
         return;
+
+    auto &output = cmdService->output();
+
+    // parse options and expand glob patterns into the list of remote files
+    size_t sessions = DEFAULT_SESSIONS;
+    bool eventLoop = false;
+    std::vector<std::string> remotePaths;
+    for (size_t i = 1; i < argvs.size(); ++i) {
+        if (argvs[i] == "-p" && i + 1 < argvs.size()) {
+            if (toUnsignedInt(argvs[++i], sessions) != 0 || sessions == 0) {
+                displayHelp();
+                return;
+            }
+        }
+        else if (argvs[i] == "-e")
+            eventLoop = true;
+        else if (argvs[i].find_first_of("*?[") != std::string::npos) {
+            if (!listRemoteFiles(argvs[i], remotePaths))
+                return;
+        }
+        else
+            remotePaths.push_back(argvs[i]);
+    }
+
+    if (remotePaths.empty()) {
+        if (argvs.size() < 2)
+            displayHelp();
+        else
+            output << "No remote file to download\n";
+        return;
+    }
+
+    // two remote files with the same name would be written to the same local file at once, so only the first is downloaded
+    std::vector<Transfer> transfers;
+    std::map<std::string, std::string> localPaths;
+    for (const auto &remotePath : remotePaths) {
+        auto slash = remotePath.find_last_of('/');
+        std::string localPath = slash == std::string::npos ? remotePath : remotePath.substr(slash + 1);
+        auto taken = localPaths.emplace(localPath, remotePath);
+        if (!taken.second) {
+            output << "Skip " << remotePath << ": local path " << localPath << " is taken by " << taken.first->second << "\n";
+            continue;
+        }
+
+        transfers.push_back({remotePath, localPath, 0, false, ""});
+    }
+
+    sessions = std::min(sessions, transfers.size());
+    auto start = std::chrono::steady_clock::now();
+    if (eventLoop)
+        retrieveEventLoop(transfers, sessions);
+    else
+        retrieveThreaded(transfers, sessions);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // report failed files and the summary
+    uint64_t received = 0;
+    size_t done = 0;
+    for (const auto &transfer : transfers) {
+        received += transfer.received;
+        if (transfer.done)
+            ++done;
+        else
+            output << "Failed to download " << transfer.remotePath << ": " << transfer.error << "\n";
+    }
+
+    std::ostringstream rate;
+    rate << std::fixed << std::setprecision(2) << seconds << " s, " << (seconds > 0 ? received / seconds / 1024 / 1024 : 0) << " MiB/s";
+    output << "Downloaded " << done << " of " << transfers.size() << " files, " << received << " bytes over " << sessions
+           << " sessions, " << rate.str() << "\n";
+    logDateTime(cmdService->logger()) << "Downloaded " << done << " of " << transfers.size() << " files, " << received << " bytes" << std::endl;
+}
+
+
+void MgetCommand::retrieveThreaded(std::vector<Transfer> &transfers, size_t sessions) {
+    // every worker keeps one session of the pool and pulls the next file from the shared list
+    auto &pool = cmdService->sessionPool(sessions);
+    std::atomic<size_t> nextTransfer{0};
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < sessions; ++i) {
+        workers.emplace_back([&pool, &transfers, &nextTransfer]() {
+            size_t index;
+            while ((index = nextTransfer++) < transfers.size()) {
+                Transfer &transfer = transfers[index];
+                try {
+                    auto session = pool.acquire();
+                    if (!session) {
+                        transfer.error = "login refused";
+                        continue;
+                    }
+
+                    // the partial file replaces the local file only once the download completes
+                    PartialFile file(transfer.localPath);
+                    if (!file.open(false)) {
+                        transfer.error = "cannot open local path";
+                        continue;
+                    }
+
+                    try {
+                        transfer.done = session->retrieve(transfer.remotePath, file.fd(), 0, 0, transfer.received);
+                    } catch (...) {
+                        session.discard();
+                        throw;
+                    }
+
+                    if (!transfer.done)
+                        transfer.error = trimString(session->lastReply().msg);
+                    else if (!file.commit()) {
+                        transfer.done  = false;
+                        transfer.error = "cannot move " + file.path() + " to the local path";
+                    }
+                } catch (const std::exception &e) {
+                    transfer.error = e.what();
+                }
+            }
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+}
+
+
+void MgetCommand::retrieveEventLoop(std::vector<Transfer> &transfers, size_t sessions) {
+    EventLoop loop;
+    std::vector<std::unique_ptr<AsyncFtpSession>> asyncSessions;
+    size_t nextTransfer = 0;
+
+    // a session pulls the next file when its last retrieval completes, and quits when none is left. Files whose
+    // local path cannot be opened are skipped without a retrieval
+    std::function<void(AsyncFtpSession &)> retrieveNext = [&](AsyncFtpSession &session) {
+        while (nextTransfer < transfers.size()) {
+            Transfer &transfer = transfers[nextTransfer++];
+
+            // the partial file replaces the local file only once the download completes
+            auto file = std::make_shared<PartialFile>(transfer.localPath);
+            if (!file->open(false)) {
+                transfer.error = "cannot open local path";
+                continue;
+            }
+
+            auto sink = [file](const Byte *buf, size_t size) {
+                return writeFileEnsure(file->fd(), buf, size);
+            };
+            session.retrieve(transfer.remotePath, sink, [&, file](bool done, const FtpCtrlReply &reply, uint64_t received) {
+                transfer.received = received;
+                transfer.done     = done && file->commit();
+                if (!done)
+                    transfer.error = trimString(reply.msg);
+                else if (!transfer.done)
+                    transfer.error = "cannot move " + file->path() + " to the local path";
+
+                // the files left to a failed session are picked up by the other sessions
+                if (session.state() != AsyncFtpSession::FAILED)
+                    retrieveNext(session);
+            });
+            return;
+        }
+
+        session.quit();
+    };
+
+    for (size_t i = 0; i < sessions; ++i) {
+        try {
+            asyncSessions.push_back(cmdService->openAsyncSession(loop));
+        } catch (const SocketException &e) {
+            logDateTime(cmdService->logger()) << "Cannot open session: " << e.what() << std::endl;
+            break;
+        }
+
+        retrieveNext(*asyncSessions.back());
+    }
+
+    loop.run();
+
+    for (auto &transfer : transfers) {
+        if (!transfer.done && transfer.error.empty())
+            transfer.error = "no session left to download the file";
+    }
+}
+
+
+bool MgetCommand::listRemoteFiles(const std::string &pattern, std::vector<std::string> &files) {
+    auto slash = pattern.find_last_of('/');
+    std::string dir      = slash == std::string::npos ? "" : pattern.substr(0, slash);
+    std::string basename = slash == std::string::npos ? pattern : pattern.substr(slash + 1);
+
+    // list the names in the remote directory
+    FtpCtrlReply reply;
+    if (!openDataConnection())
+        return false;
+
+    ftpService->sendNLST(dir);
+    getFtpReplyAndCheckTimeout(reply);
+    if (reply.replyClass != POSITIVE_PRELIMINARY) {
+        ftpService->closeDataConnect();
+        return false;
+    }
+
+    std::vector<Byte> buf;
+    ftpService->readDataReply(buf);
+    ftpService->closeDataConnect();
+
+    getFtpReplyAndCheckTimeout(reply);
+    if (reply.code != CLOSE_DATA_CONNECTION_REQUEST_FILE_ACTION_SUCCESS)
+        return false;
+
+    // some servers return the names with the directory prefix, so match only the last component
+    std::string names(buf.begin(), buf.end());
+    for (auto name : splitString(names, "\n")) {
+        name.erase(std::remove(name.begin(), name.end(), '\r'), name.end());
+        auto nameSlash = name.find_last_of('/');
+        std::string nameBase = nameSlash == std::string::npos ? name : name.substr(nameSlash + 1);
+        if (nameBase.empty() || fnmatch(basename.c_str(), nameBase.c_str(), 0) != 0)
+            continue;
+
+        files.push_back(dir.empty() ? nameBase : dir + "/" + nameBase);
     }
-    file.write(reinterpret_cast<const char *>(buf.data()), buf.size());
+
+    return true;
 }
 
 
@@ -624,8 +1362,9 @@ const std::string PutCommand::PROG = "put";
 
 void PutCommand::displayHelp() {
     auto &output = cmdService->output();
-    output << "Usage : Upload the local file to the ftp server and save as the remote file name. Remote file is optional and default to be local file name\n";
-    output << "Syntax: put <Space> <Local File> [<Space> <Remote File>] <Enter>\n";
+    output << "Usage : Upload the local file to the ftp server and save as the remote file name. Remote file is optional and default to be local file name. "
+              "An interrupted upload is resumed from the end of the remote file if its journal is found. With -c, it is resumed even without journal\n";
+    output << "Syntax: put [<Space> -c] <Space> <Local File> [<Space> <Remote File>] <Enter>\n";
 }
 
 
@@ -633,7 +1372,17 @@ void PutCommand::execute(const std::vector<std::string> &argvs) {
     if (!checkCmdServiceAvailable())
         return;
 
-    if (argvs.size() < 2) {
+    // parse options and paths
+    bool resume = false;
+    std::vector<std::string> paths;
+    for (size_t i = 1; i < argvs.size(); ++i) {
+        if (argvs[i] == "-c")
+            resume = true;
+        else
+            paths.push_back(argvs[i]);
+    }
+
+    if (paths.empty()) {
         displayHelp();
         return;
     }
@@ -641,16 +1390,8 @@ void PutCommand::execute(const std::vector<std::string> &argvs) {
     auto &output = cmdService->output();
 
     // get local path and remote path
-    std::string localPath  = "";
-    std::string remotePath = "";
-    if (argvs.size() == 2) {
-        localPath  = argvs[1];
-        remotePath = localPath;
-    }
-    else {
-        localPath  = argvs[1];
-        remotePath = argvs[2];
-    }
+    std::string localPath  = paths[0];
+    std::string remotePath = paths.size() == 1 ? localPath : paths[1];
     output << "Local path: " << localPath << "\n";
     output << "Remote path: " << remotePath << "\n";
 
@@ -660,28 +1401,120 @@ void PutCommand::execute(const std::vector<std::string> &argvs) {
         return;
     }
 
-    // open data connection
+    // open local file
+    FileDescriptor file(open(localPath.c_str(), O_RDONLY));
+    struct stat fileStat;
+    if (file.get() == -1 || fstat(file.get(), &fileStat) == -1) {
+        output << "Cannot open local path: " << localPath << "\n";
+        return;
+    }
+
+    // the size and modification time of the local file identify the upload in the journal
+    uint64_t fileSize = static_cast<uint64_t>(fileStat.st_size);
+    TransferJournal journal(localPath);
+    TransferJournal::Entry entry{"put", remotePath, fileSize, std::to_string(fileStat.st_mtime)};
+
+    // the remote file is the checkpoint: whatever reached the server does not need to be uploaded again
     FtpCtrlReply reply;
+    uint64_t offset = 0;
+    if (resume || journal.matches(entry)) {
+        ftpService->sendTYPE('I');
+        getFtpReplyAndCheckTimeout(reply);
+        if (reply.code == COMMAND_OK)
+            ftpService->setTransferType('I');
+
+        uint64_t remoteSize;
+        if (getRemoteSize(remotePath, remoteSize) && remoteSize <= fileSize)
+            offset = remoteSize;
+    }
+
+    if (offset > 0 && offset == fileSize) {
+        output << "Remote file is already complete\n";
+        journal.remove();
+        return;
+    }
+
+    if (!journal.save(entry))
+        output << "Cannot write transfer journal: " << journal.path() << "\n";
+
+    // open data connection
     if (!openDataConnection())
         return;
 
-    // send STOR cmd
-    ftpService->sendSTOR(remotePath);
+    // restart the upload at the end of the remote file, with APPE if the server cannot restart STOR
+    bool append = false;
+    if (offset > 0) {
+        ftpService->sendREST(offset);
+        getFtpReplyAndCheckTimeout(reply);
+        append = reply.code != REQUESTED_FILE_ACTION_PENDING_FOR_FURTHER_INFO;
+        output << "Resume upload at byte " << offset << "\n";
+    }
+
+    // send STOR or APPE cmd
+    if (append)
+        ftpService->sendAPPE(remotePath);
+    else
+        ftpService->sendSTOR(remotePath);
     getFtpReplyAndCheckTimeout(reply);
-    if (reply.code != FILE_STATUS_OK_OPEN_DATA_CONNECTION) {
+    if (reply.replyClass != POSITIVE_PRELIMINARY) {
         ftpService->closeDataConnect();
+        if (offset == 0)
+            journal.remove();
         return;
     }
 
-    // read file here and send data to the server
-    std::ifstream file(localPath);
-    std::vector<Byte> buf;
-    std::copy(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>(), std::back_inserter(buf));
-    ftpService->sendDataConnect(buf);
+    // let the kernel copy the file straight to the data connection
+    ftpService->setExpectedTransferSize(fileSize - offset);
+    bool sent = ftpService->sendDataConnect(file.get(), static_cast<off_t>(offset), static_cast<size_t>(fileSize - offset));
+    int readError = errno;
     ftpService->closeDataConnect();
 
+    if (!sent)
+        output << "Failed to read local path: " << localPath << ": " << strerror(readError) << "\n";
+
     // read server reply from ctrl connection
     getFtpReplyAndCheckTimeout(reply);
+    if (sent && (reply.code == CLOSE_DATA_CONNECTION_REQUEST_FILE_ACTION_SUCCESS || reply.code == REQUESTED_FILE_ACTION_COMPLETED))
+        journal.remove();
+}
+
+
+/************************************************************
+ * SizeCommand class definition
+ ************************************************************/
+const std::string SizeCommand::PROG = "size";
+
+
+void SizeCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Print the size of the remote files\n";
+    output << "Syntax: size <Space> <Remote File> [<Space> <Remote File> ...] <Enter>\n";
+}
+
+
+void SizeCommand::execute(const std::vector<std::string> &argvs) {
+    if (!checkCmdServiceAvailable())
+        return;
+
+    if (argvs.size() < 2) {
+        displayHelp();
+        return;
+    }
+
+    auto &output = cmdService->output();
+
+    // send every SIZE cmd at once and match the replies in order. The replies stop early at a 421 reply
+    std::vector<std::string> paths(argvs.begin() + 1, argvs.end());
+    std::vector<FtpCtrlReply> replies;
+    ftpService->sendPipelinedSIZE(paths, replies);
+    for (size_t i = 0; i < replies.size(); ++i) {
+        output << argvs[i + 1] << ": " << replies[i].msg;
+        if (replies[i].code == SERVICE_UNAVAILABLE) {
+            cmdService->setServiceAvailable(false);
+            ftpService->closeCtrlConnect();
+            return;
+        }
+    }
 }
 
 
@@ -708,3 +1541,369 @@ void PassiveCommand::execute(const std::vector<std::string> &) {
         output << "Passive mode off\n";
 }
 
+
+/************************************************************
+ * UringCommand class definition
+ ************************************************************/
+const std::string UringCommand::PROG = "uring";
+
+
+void UringCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Toggle io_uring engine for get and put\n";
+    output << "Syntax: uring <Enter>\n";
+}
+
+
+void UringCommand::execute(const std::vector<std::string> &) {
+    auto &output = cmdService->output();
+    if (ftpService->ioUringEnabled()) {
+        ftpService->setIoUringEnabled(false);
+        output << "io_uring off\n";
+    }
+    else if (ftpService->setIoUringEnabled(true))
+        output << "io_uring on\n";
+    else
+        output << "io_uring not available\n";
+}
+
+
+/************************************************************
+ * CompressCommand class definition
+ ************************************************************/
+const std::string CompressCommand::PROG = "compress";
+
+
+void CompressCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Toggle MODE Z compression for ls, get and put. Stream mode is kept if the server does not support it\n";
+    output << "Syntax: compress <Enter>\n";
+}
+
+
+void CompressCommand::execute(const std::vector<std::string> &) {
+    if (!checkCmdServiceAvailable())
+        return;
+
+    auto &output = cmdService->output();
+    FtpCtrlReply reply;
+    if (ftpService->transferMode() == COMPRESSED_MODE) {
+        ftpService->sendMODE(STREAM_MODE);
+        getFtpReplyAndCheckTimeout(reply);
+        if (reply.code == COMMAND_OK) {
+            ftpService->setTransferMode(STREAM_MODE);
+            output << "Compression off\n";
+        }
+
+        return;
+    }
+
+    if (!serverSupportsModeZ()) {
+        output << "Server does not support MODE Z. Keep stream mode\n";
+        return;
+    }
+
+    ftpService->sendMODE(COMPRESSED_MODE);
+    getFtpReplyAndCheckTimeout(reply);
+    if (reply.code != COMMAND_OK) {
+        output << "Server refuses MODE Z. Keep stream mode\n";
+        return;
+    }
+
+    ftpService->setTransferMode(COMPRESSED_MODE);
+    output << "Compression on\n";
+}
+
+
+bool CompressCommand::serverSupportsModeZ() {
+    FtpCtrlReply reply;
+    ftpService->sendFEAT();
+    getFtpReplyAndCheckTimeout(reply);
+    if (reply.code != SYSTEM_STATUS)
+        return false;
+
+    // every feature is listed on its own line, indented by a space
+    for (const auto &line : splitString(reply.msg, "\r\n")) {
+        auto feature = trimString(line);
+        std::transform(feature.begin(), feature.end(), feature.begin(), ::toupper);
+        if (feature == "MODE Z")
+            return true;
+    }
+
+    return false;
+}
+
+
+/************************************************************
+ * BlockCommand class definition
+ ************************************************************/
+const std::string BlockCommand::PROG = "block";
+
+
+void BlockCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Toggle MODE B block mode. In block mode, one data connection is kept open for ls, get and put\n";
+    output << "Syntax: block <Enter>\n";
+}
+
+
+void BlockCommand::execute(const std::vector<std::string> &) {
+    if (!checkCmdServiceAvailable())
+        return;
+
+    auto &output = cmdService->output();
+    bool block = ftpService->transferMode() == BLOCK_MODE;
+    TransferMode mode = block ? STREAM_MODE : BLOCK_MODE;
+
+    FtpCtrlReply reply;
+    ftpService->sendMODE(mode);
+    getFtpReplyAndCheckTimeout(reply);
+    if (reply.code != COMMAND_OK) {
+        output << "Server refuses MODE " << static_cast<char>(mode) << "\n";
+        return;
+    }
+
+    ftpService->setTransferMode(mode);
+    output << (block ? "Block mode off\n" : "Block mode on\n");
+}
+
+
+/************************************************************
+ * PasvAddrCommand class definition
+ ************************************************************/
+const std::string PasvAddrCommand::PROG = "pasvaddr";
+
+
+void PasvAddrCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Toggle between the address advertised in PASV reply and the address of the control connection for passive data connection\n";
+    output << "Syntax: pasvaddr <Enter>\n";
+}
+
+
+void PasvAddrCommand::execute(const std::vector<std::string> &) {
+    auto &output = cmdService->output();
+    bool advertised = !ftpService->useAdvertisedAddress();
+    ftpService->setUseAdvertisedAddress(advertised);
+    if (advertised)
+        output << "Passive data connection goes to the address advertised by the server\n";
+    else
+        output << "Passive data connection goes to the address of the control connection\n";
+}
+
+
+/************************************************************
+ * PortRangeCommand class definition
+ ************************************************************/
+const std::string PortRangeCommand::PROG = "portrange";
+
+
+void PortRangeCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Set the range of local ports for active data connection. Without range, the port is chosen by the system\n";
+    output << "Syntax: portrange [<Space> <Min Port> <Space> <Max Port>] <Enter>\n";
+}
+
+
+void PortRangeCommand::execute(const std::vector<std::string> &argvs) {
+    auto &output = cmdService->output();
+    if (argvs.size() == 1) {
+        ftpService->setActivePortRange(0, 0);
+        output << "Active data connection listens on a port chosen by the system\n";
+        return;
+    }
+
+    uint64_t portMin, portMax;
+    bool rangeInvalid = argvs.size() != 3                      ||
+                        toUnsignedInt(argvs[1], portMin) != 0  ||
+                        toUnsignedInt(argvs[2], portMax) != 0  ||
+                        portMin < FtpService::USABLE_PORT_MIN  ||
+                        portMax > FtpService::USABLE_PORT_MAX  ||
+                        portMin > portMax;
+
+    if (rangeInvalid) {
+        displayHelp();
+        return;
+    }
+
+    ftpService->setActivePortRange(static_cast<uint16_t>(portMin), static_cast<uint16_t>(portMax));
+    output << "Active data connection listens on a port from " << portMin << " to " << portMax << "\n";
+}
+
+
+/************************************************************
+ * ListenerCommand class definition
+ ************************************************************/
+const std::string ListenerCommand::PROG = "listener";
+
+
+void ListenerCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Toggle keeping a few listening sockets open, used in turn by the active data connections of the session\n";
+    output << "Syntax: listener <Enter>\n";
+}
+
+
+void ListenerCommand::execute(const std::vector<std::string> &) {
+    auto &output = cmdService->output();
+    bool keep = !ftpService->keepListener();
+    ftpService->setKeepListener(keep);
+    if (keep)
+        output << "Listening sockets kept for active data connection\n";
+    else
+        output << "Listening socket opened for every active data connection\n";
+}
+
+
+/************************************************************
+ * TuneCommand class definition
+ ************************************************************/
+const std::string TuneCommand::PROG = "tune";
+
+
+void TuneCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Choose the socket options for the path to the host: lan, wan or satellite. Without profile, print the profile in use\n";
+    output << "Syntax: tune [<Space> <Profile>] <Enter>\n";
+}
+
+
+void TuneCommand::execute(const std::vector<std::string> &argvs) {
+    auto &output = cmdService->output();
+    if (argvs.size() == 1) {
+        output << "Socket options profile " << ftpService->socketOptions().profile << "\n";
+        return;
+    }
+
+    SocketOptions options;
+    if (argvs.size() != 2 || !SocketOptions::fromProfile(argvs[1], options)) {
+        displayHelp();
+        return;
+    }
+
+    // pooled sessions are opened again with the new options
+    ftpService->setSocketOptions(options);
+    cmdService->closeSessionPool();
+    output << "Socket options profile " << options.profile << "\n";
+}
+
+
+/************************************************************
+ * TimeoutCommand class definition
+ ************************************************************/
+const std::string TimeoutCommand::PROG = "timeout";
+
+
+void TimeoutCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Set the timeouts in seconds of connect, accept of active data connection, idle read and write, and whole data transfer. "
+              "Timeout 0 waits forever, and a timeout is at most 2147483 seconds. Without timeouts, print the timeouts in use\n";
+    output << "Syntax: timeout [<Space> <Connect> <Space> <Accept> <Space> <Idle> <Space> <Transfer>] <Enter>\n";
+}
+
+
+void TimeoutCommand::execute(const std::vector<std::string> &argvs) {
+    auto &output = cmdService->output();
+    if (argvs.size() != 1) {
+        static const uint64_t TIMEOUT_SECONDS_MAX = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(FtpService::TIMEOUT_MAX).count());
+
+        uint64_t seconds[4];
+        if (argvs.size() != 5) {
+            displayHelp();
+            return;
+        }
+
+        for (size_t i = 0; i < 4; ++i) {
+            if (toUnsignedInt(argvs[i + 1], seconds[i]) != 0 || seconds[i] > TIMEOUT_SECONDS_MAX) {
+                displayHelp();
+                return;
+            }
+        }
+
+        FtpTimeouts timeouts;
+        timeouts.connect  = std::chrono::seconds(seconds[0]);
+        timeouts.accept   = std::chrono::seconds(seconds[1]);
+        timeouts.idle     = std::chrono::seconds(seconds[2]);
+        timeouts.transfer = std::chrono::seconds(seconds[3]);
+
+        // pooled sessions are opened again with the new timeouts
+        ftpService->setTimeouts(timeouts);
+        cmdService->closeSessionPool();
+    }
+
+    using std::chrono::duration_cast;
+    using std::chrono::seconds;
+    const auto &timeouts = ftpService->timeouts();
+    output << "Connect "   << duration_cast<seconds>(timeouts.connect).count()  << " s, "
+           << "accept "    << duration_cast<seconds>(timeouts.accept).count()   << " s, "
+           << "idle "      << duration_cast<seconds>(timeouts.idle).count()     << " s, "
+           << "transfer "  << duration_cast<seconds>(timeouts.transfer).count() << " s\n";
+}
+
+
+/************************************************************
+ * RateCommand class definition
+ ************************************************************/
+const std::string RateCommand::PROG = "rate";
+
+
+void RateCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Limit the rate in KiB/s of every transfer and of all sessions together, with bursts upto Burst KiB. "
+              "Rate 0 means no limit. Without rates, print the limits in use\n";
+    output << "Syntax: rate [<Space> <Transfer Rate> <Space> <Total Rate> [<Space> <Burst>]] <Enter>\n";
+}
+
+
+void RateCommand::execute(const std::vector<std::string> &argvs) {
+    static const uint64_t KIB = 1024;
+    static const uint64_t RATE_MAX = std::numeric_limits<uint32_t>::max();
+
+    auto &output = cmdService->output();
+    auto &sharedLimit = *ftpService->sharedRateLimit();
+    if (argvs.size() != 1) {
+        uint64_t transferRate, totalRate, burst = 0;
+        bool rateInvalid = (argvs.size() != 3 && argvs.size() != 4)                       ||
+                           toUnsignedInt(argvs[1], transferRate) != 0                     ||
+                           toUnsignedInt(argvs[2], totalRate) != 0                        ||
+                           (argvs.size() == 4 && toUnsignedInt(argvs[3], burst) != 0)     ||
+                           transferRate > RATE_MAX || totalRate > RATE_MAX || burst > RATE_MAX;
+
+        if (rateInvalid) {
+            displayHelp();
+            return;
+        }
+
+        // the total rate is shared with the pooled sessions and takes effect right away
+        ftpService->setTransferRateLimit(transferRate * KIB, burst * KIB);
+        sharedLimit.setRate(totalRate * KIB, burst * KIB);
+        cmdService->closeSessionPool();
+    }
+
+    const auto &transferLimit = ftpService->transferRateLimit();
+    output << "Transfer rate "  << transferLimit.rate() / KIB << " KiB/s, burst " << transferLimit.burst() / KIB << " KiB; "
+           << "total rate "     << sharedLimit.rate() / KIB   << " KiB/s, burst " << sharedLimit.burst() / KIB   << " KiB\n";
+}
+
+
+/************************************************************
+ * ProgressCommand class definition
+ ************************************************************/
+const std::string ProgressCommand::PROG = "progress";
+
+
+void ProgressCommand::displayHelp() {
+    auto &output = cmdService->output();
+    output << "Usage : Toggle drawing the bytes transferred, the current and average rate and the ETA of get and put while they run\n";
+    output << "Syntax: progress <Enter>\n";
+}
+
+
+void ProgressCommand::execute(const std::vector<std::string> &) {
+    auto &output = cmdService->output();
+    cmdService->setShowProgress(!cmdService->showProgress());
+    if (cmdService->showProgress())
+        output << "Progress on\n";
+    else
+        output << "Progress off\n";
+}
@@ -5,10 +5,15 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
 #include "FtpService.h"
+#include "FtpSession.h"
+#include "SessionPool.h"
+#include "AsyncFtpSession.h"
 
 
 class Command;
+class PartialFile;
 
 
 /*
@@ -44,6 +49,45 @@ public:
      */
     void setServiceAvailable(bool available);
 
+    /*
+     * Remember the credentials the user logged in with, so that more sessions can be opened later.
+     * The remote directories remembered for the previous login are forgotten
+     */
+    void setCredentials(const std::string &user, const std::string &password);
+
+    /*
+     * Remember the remote directory the user changed to, so that the session changes to it again when
+     * it logs in again. An absolute path replaces the directories remembered before
+     */
+    void rememberDirectory(const std::string &path);
+
+    /*
+     * Open a new session to the ftp server, log in with the remembered credentials and change to the
+     * remembered remote directories. The session can be used on another thread. Function returns nullptr
+     * if the server refuses the login or a directory
+     */
+    std::unique_ptr<FtpSession> openSession();
+
+    /*
+     * Start a non-blocking session to the ftp server on the event loop, logged in with the remembered
+     * credentials into the remembered remote directories, and limited by the timeouts and rate limits
+     * of the ftp service. The session can only
+     * be used on the thread that runs the event loop
+     */
+    std::unique_ptr<AsyncFtpSession> openAsyncSession(EventLoop &loop);
+
+    /*
+     * Get the pool of sessions used for concurrent transfers. The pool is created on first use and
+     * grows if more sessions are requested, so the sessions already logged in are kept. A caller
+     * leases at most the number of sessions it requested
+     */
+    SessionPool &sessionPool(size_t sessions);
+
+    /*
+     * Log out every session of the pool. It should be called whenever the interactive session is closed
+     */
+    void closeSessionPool();
+
     /*
      * Check if passive mode for data connection is turned on
      */
@@ -56,6 +100,17 @@ public:
      */
     void setPassiveMode(bool passive);
 
+    /*
+     * Check if the progress of get and put is drawn while they run
+     */
+    bool showProgress() const;
+
+    /*
+     * Turn on or off drawing the progress of transfers of the interactive session. It is on by default
+     * when the output is a terminal
+     */
+    void setShowProgress(bool show);
+
     /*
      * Check if the command service should terminate or not
      */
@@ -81,7 +136,7 @@ public:
 
     /*
      * Get the logger stream. It is not neccessary file logger. Command interface should
-     * use this stream to log any messages
+     * use this stream to log any messages. The stream must only be used on the interactive thread
      */
     std::ostream &logger();
 
@@ -135,6 +190,12 @@ protected:
      */
     bool checkCmdServiceAvailable();
 
+    /*
+     * Helper function to get the size of the remote file with SIZE command. Function returns false
+     * if the server refuses the command
+     */
+    bool getRemoteSize(const std::string &remotePath, uint64_t &size);
+
     /*
      * Get control reply from ftp server. If reply code indicates time out, the function
      * will disconnect ftp server
@@ -296,6 +357,63 @@ public:
     void execute(const std::vector<std::string> &argvs) override;
 
     static const std::string PROG;
+
+private:
+    /*
+     * Helper function to download the remote file in segments, each over its own session
+     */
+    void executeSegmented(const std::string &remotePath, const std::string &localPath, unsigned segments);
+
+    /*
+     * Helper function to move the complete download over the local file. Function returns false if it
+     * cannot be moved
+     */
+    bool commitDownload(PartialFile &file);
+};
+
+
+/*
+ * MgetCommand
+ * Retrieve several remote files concurrently over a pool of sessions
+ */
+class MgetCommand : public Command {
+public:
+    MgetCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+
+    static const size_t DEFAULT_SESSIONS = 4;
+
+private:
+    struct Transfer {
+        std::string remotePath;
+        std::string localPath;
+        uint64_t received;
+        bool done;
+        std::string error;
+    };
+
+    /*
+     * Helper function to list the remote files that match the glob pattern. The pattern may only
+     * contain wildcards in its last path component
+     */
+    bool listRemoteFiles(const std::string &pattern, std::vector<std::string> &files);
+
+    /*
+     * Helper function to download the files with one thread per session of the session pool
+     */
+    void retrieveThreaded(std::vector<Transfer> &transfers, size_t sessions);
+
+    /*
+     * Helper function to download the files with non-blocking sessions, all driven by one event loop
+     */
+    void retrieveEventLoop(std::vector<Transfer> &transfers, size_t sessions);
 };
 
 
@@ -317,6 +435,24 @@ public:
 };
 
 
+/*
+ * SizeCommand
+ * Print the size of one or more remote files. The SIZE commands are pipelined
+ */
+class SizeCommand : public Command {
+public:
+    SizeCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
 /*
  * PassiveCommand
  * Toggle the passive mode for data connection
@@ -335,4 +471,197 @@ public:
 };
 
 
+/*
+ * UringCommand
+ * Toggle the io_uring engine for file transfers through data connection
+ */
+class UringCommand : public Command {
+public:
+    UringCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
+/*
+ * CompressCommand
+ * Toggle MODE Z, which deflates the data sent through data connection
+ */
+class CompressCommand : public Command {
+public:
+    CompressCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+
+private:
+    /*
+     * Helper function to check if the server lists MODE Z in the reply of FEAT command
+     */
+    bool serverSupportsModeZ();
+};
+
+
+/*
+ * BlockCommand
+ * Toggle MODE B, which keeps one data connection open across transfers
+ */
+class BlockCommand : public Command {
+public:
+    BlockCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
+
+/*
+ * PasvAddrCommand
+ * Toggle the address used by passive data connections
+ */
+class PasvAddrCommand : public Command {
+public:
+    PasvAddrCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
+
+/*
+ * PortRangeCommand
+ * Set the range of local ports that active data connections listen on
+ */
+class PortRangeCommand : public Command {
+public:
+    PortRangeCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
+
+/*
+ * ListenerCommand
+ * Toggle keeping a few listening sockets, used in turn, for active data connections
+ */
+class ListenerCommand : public Command {
+public:
+    ListenerCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
+
+/*
+ * TuneCommand
+ * Choose the socket options profile for the path to the host
+ */
+class TuneCommand : public Command {
+public:
+    TuneCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
+
+/*
+ * TimeoutCommand
+ * Set the timeouts of connect, accept, idle read and write, and data transfer
+ */
+class TimeoutCommand : public Command {
+public:
+    TimeoutCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
+
+/*
+ * RateCommand
+ * Limit the rate of every data transfer and the total rate of all sessions
+ */
+class RateCommand : public Command {
+public:
+    RateCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
+
+/*
+ * ProgressCommand
+ * Toggle drawing the progress of get and put while they run
+ */
+class ProgressCommand : public Command {
+public:
+    ProgressCommand(FtpService *ftp, CommandService *cmd)
+        : Command{ftp, cmd}
+    {}
+
+    void displayHelp() override;
+
+    void execute(const std::vector<std::string> &argvs) override;
+
+    static const std::string PROG;
+};
+
+
 #endif // CMD_H
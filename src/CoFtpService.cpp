@@ -0,0 +1,447 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include "CoFtpService.h"
+#include "ConnectRace.h"
+#include "FtpReplyFramer.h"
+#include "Utility.h"
+
+
+static const size_t CTRL_READ_SIZE  = 2048;
+static const size_t DATA_CHUNK_SIZE = 65536;
+
+
+/*
+ * AttemptAwaiter class
+ * Suspend the coroutine until one of the connect attempts is writable, or until the wait is over. The
+ * coroutine resumes with the ready socket, or -1 if the wait is over. A negative wait waits forever
+ */
+class AttemptAwaiter {
+public:
+    AttemptAwaiter(EventLoop &loop, std::vector<int> sockfds, std::chrono::milliseconds wait)
+        : _loop{loop}, _sockfds{std::move(sockfds)}, _wait{wait}, _ready{-1}, _watching{false}, _timer{0}
+    {}
+
+    AttemptAwaiter(const AttemptAwaiter &) = delete;
+
+    AttemptAwaiter &operator=(const AttemptAwaiter &) = delete;
+
+    ~AttemptAwaiter() {
+        stopWatching();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        for (int sockfd : _sockfds) {
+            _loop.add(sockfd, EPOLLOUT, [this, sockfd, handle](uint32_t) {
+                _ready = sockfd;
+                stopWatching();
+                handle.resume();
+            });
+        }
+        _watching = true;
+
+        if (_wait.count() >= 0) {
+            _timer = _loop.addTimer(_wait, [this, handle]() {
+                _timer = 0;
+                stopWatching();
+                handle.resume();
+            });
+        }
+    }
+
+    int await_resume() const noexcept { return _ready; }
+
+private:
+    void stopWatching() {
+        if (_watching) {
+            for (int sockfd : _sockfds)
+                _loop.remove(sockfd);
+            _watching = false;
+        }
+
+        if (_timer != 0) {
+            _loop.cancelTimer(_timer);
+            _timer = 0;
+        }
+    }
+
+    EventLoop &_loop;
+    std::vector<int> _sockfds;
+    std::chrono::milliseconds _wait;
+    int _ready;
+    bool _watching;
+    EventLoop::TimerId _timer;
+};
+
+
+struct CoFtpService::Impl {
+    using Address = SocketAddress;
+
+    using Clock = std::chrono::steady_clock;
+
+
+    Impl(EventLoop &eventLoop, std::ostream *log)
+        : loop(eventLoop), logger{log}, timeouts{}, connectAttemptDelay{FtpService::CONNECT_ATTEMPT_DELAY},
+          socketOptions(SocketOptions::lan())
+    {}
+
+
+    /*
+     * Helper function to wait until the socket is ready for the events within the idle timeout.
+     * Throw TimeoutException with the operation if it is not
+     */
+    CoTask<void> waitIdle(int fd, uint32_t events, std::string operation) {
+        SocketAwaiter ready(loop, fd, events, timeouts.idle);
+        if (co_await ready == 0)
+            throw TimeoutException(operation);
+    }
+
+
+    /*
+     * Helper function to run the connect race to the addresses within the connect timeout. The attempts are
+     * watched by the event loop, and the wait ends early when the next attempt is due. Sockets of data
+     * connection are tuned before they connect. Function returns the winning socket with the index of its
+     * address. Throw TimeoutException if no attempt connects in time, and SocketException with the error of
+     * the last attempt if every attempt fails
+     */
+    CoTask<int> connectRace(std::vector<Address> addresses, bool dataChannel, size_t &winner) {
+        ConnectRace::SocketSetup setup;
+        if (dataChannel)
+            setup = [this](int fd) { socketOptions.applyToDataSocket(fd, *logger); };
+
+        ConnectRace race(addresses, connectAttemptDelay, setup);
+        auto deadline = Clock::now() + timeouts.connect;
+        while (true) {
+            while (race.startNext() != -1 && !race.won()) {}
+
+            if (race.won())
+                co_return race.take(winner);
+
+            if (race.failed()) {
+                errno = race.lastError();
+                throw SocketException();
+            }
+
+            auto wait = race.nextStartIn();
+            if (timeouts.connect.count() > 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+                if (left.count() <= 0)
+                    throw TimeoutException("connecting");
+
+                if (wait.count() < 0 || left < wait)
+                    wait = left;
+            }
+
+            AttemptAwaiter attempt(loop, race.attempts(), wait);
+            int sockfd = co_await attempt;
+            if (sockfd != -1 && race.check(sockfd))
+                co_return race.take(winner);
+        }
+    }
+
+
+    /*
+     * Helper function to count the bytes received on the data connection. They are added to the progress and
+     * taken out of the rate limits, and the transfer pauses on a timer while a limit is in debt
+     */
+    CoTask<void> countTransferred(size_t bytes) {
+        progress.add(bytes);
+
+        auto wait = transferLimit.take(bytes);
+        if (sharedLimit)
+            wait = std::max(wait, sharedLimit->take(bytes));
+
+        if (wait.count() > 0) {
+            auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(wait + std::chrono::milliseconds(1)
+                                                                                - std::chrono::nanoseconds(1));
+            TimerAwaiter pause(loop, waitMs);
+            co_await pause;
+        }
+    }
+
+
+    void closeData() {
+        if (dataSockfd == -1)
+            return;
+
+        ::close(dataSockfd);
+        dataSockfd = -1;
+        logDateTime(*logger) << "Closed data connection with host " << hostname << std::endl;
+    }
+
+
+    EventLoop &loop;
+    std::ostream *logger;
+    FtpTimeouts timeouts;
+    std::chrono::milliseconds connectAttemptDelay;
+    SocketOptions socketOptions;
+    TokenBucket transferLimit;
+    std::shared_ptr<TokenBucket> sharedLimit;
+    ProgressMeter progress;
+    std::string hostname;
+    Address peer;
+    int ctrlSockfd = -1;
+    int dataSockfd = -1;
+    FtpReplyFramer ctrlFramer;
+    FtpCtrlReply lastReply{static_cast<FtpCode>(0), INVALID_REPLY, ""};
+};
+
+
+CoFtpService::CoFtpService(EventLoop &loop, std::ostream *log) {
+    _impl = std::make_unique<Impl>(loop, log);
+}
+
+
+CoFtpService::~CoFtpService() {
+    close();
+}
+
+
+void CoFtpService::setTimeouts(const FtpTimeouts &timeouts) {
+    _impl->timeouts = timeouts;
+}
+
+
+const FtpTimeouts &CoFtpService::timeouts() const {
+    return _impl->timeouts;
+}
+
+
+void CoFtpService::setConnectAttemptDelay(std::chrono::milliseconds delay) {
+    _impl->connectAttemptDelay = delay;
+}
+
+
+void CoFtpService::setSocketOptions(const SocketOptions &options) {
+    _impl->socketOptions = options;
+}
+
+
+void CoFtpService::setTransferRateLimit(uint64_t rate, uint64_t burst) {
+    _impl->transferLimit.setRate(rate, burst);
+}
+
+
+void CoFtpService::setSharedRateLimit(std::shared_ptr<TokenBucket> limit) {
+    _impl->sharedLimit = std::move(limit);
+}
+
+
+void CoFtpService::setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval) {
+    _impl->progress.setCallback(std::move(callback), interval);
+}
+
+
+CoTask<FtpCtrlReply> CoFtpService::connect(std::string hostname, uint16_t port) {
+    std::vector<Impl::Address> addresses = resolveHost(hostname, std::to_string(port));
+
+    size_t winner;
+    int fd = co_await _impl->connectRace(addresses, false, winner);
+    _impl->socketOptions.applyToCtrlSocket(fd, *_impl->logger);
+    _impl->ctrlSockfd = fd;
+    _impl->ctrlFramer.reset();
+    _impl->hostname = hostname;
+    _impl->peer = addresses[winner];
+    logDateTime(*_impl->logger) << "Opened control connection with host " << hostname << " port " << port << std::endl;
+
+    co_return co_await readReply();
+}
+
+
+CoTask<FtpCtrlReply> CoFtpService::readReply() {
+    auto &framer = _impl->ctrlFramer;
+    while (!framer.next()) {
+        size_t available;
+        char *buf = framer.prepare(CTRL_READ_SIZE, available);
+        auto rn = recv(_impl->ctrlSockfd, buf, available, 0);
+        if (rn > 0)
+            framer.commit(static_cast<size_t>(rn));
+        else if (rn == 0) {
+            errno = ECONNRESET;
+            throw SocketException();
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await _impl->waitIdle(_impl->ctrlSockfd, EPOLLIN, "reading socket");
+        else if (errno != EINTR)
+            throw SocketException();
+    }
+
+    FtpReplyLine text = framer.text();
+    FtpCtrlReply reply;
+    reply.msg.assign(text.data, text.size);
+    reply.code       = static_cast<FtpCode>(framer.code());
+    reply.replyClass = framer.replyClass();
+    logDateTime(*_impl->logger) << "Received " << reply.msg << std::flush;
+
+    _impl->lastReply = reply;
+    co_return reply;
+}
+
+
+CoTask<void> CoFtpService::sendCommand(std::string cmd) {
+    size_t writeSofar = 0;
+    while (writeSofar < cmd.size()) {
+        auto wn = send(_impl->ctrlSockfd, cmd.data() + writeSofar, cmd.size() - writeSofar, MSG_NOSIGNAL);
+        if (wn >= 0)
+            writeSofar += static_cast<size_t>(wn);
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await _impl->waitIdle(_impl->ctrlSockfd, EPOLLOUT, "writing socket");
+        else if (errno != EINTR)
+            throw SocketException();
+    }
+
+    logDateTime(*_impl->logger) << "Sent " << cmd;
+}
+
+
+CoTask<FtpCtrlReply> CoFtpService::command(std::string cmd) {
+    co_await sendCommand(std::move(cmd));
+    co_return co_await readReply();
+}
+
+
+CoTask<bool> CoFtpService::login(std::string user, std::string password) {
+    auto reply = co_await command("USER " + user + "\r\n");
+    if (reply.code == USER_OK_PASSWORD_NEEDED)
+        reply = co_await command("PASS " + password + "\r\n");
+
+    if (reply.code != USER_LOGGED_IN_PROCCEED)
+        co_return false;
+
+    reply = co_await command("TYPE I\r\n");
+    co_return reply.code == COMMAND_OK;
+}
+
+
+CoTask<bool> CoFtpService::openPassive() {
+    // the data connection goes to the address of the control connection
+    Impl::Address address = _impl->peer;
+    uint16_t port;
+    if (address.first.ss_family == AF_INET6) {
+        auto reply = co_await command("EPSV 2\r\n");
+        if (reply.code != ENTERING_EXTENDED_PASSIVE_MODE)
+            co_return false;
+
+        FtpService::parseEPSVReply(reply.msg, port);
+        reinterpret_cast<sockaddr_in6 *>(&address.first)->sin6_port = htons(port);
+    }
+    else {
+        auto reply = co_await command("PASV\r\n");
+        if (reply.code != ENTERING_PASSIVE_MODE)
+            co_return false;
+
+        std::string ipAddr;
+        FtpService::parsePASVReply(reply.msg, ipAddr, port);
+        reinterpret_cast<sockaddr_in *>(&address.first)->sin_port = htons(port);
+    }
+
+    size_t winner;
+    int fd = co_await _impl->connectRace(std::vector<Impl::Address>(1, address), true, winner);
+    _impl->closeData();
+    _impl->dataSockfd = fd;
+    logDateTime(*_impl->logger) << "Opened passive data connection with host " << _impl->hostname << " port " << port << std::endl;
+    co_return true;
+}
+
+
+CoTask<bool> CoFtpService::retr(std::string remotePath, DataSink sink) {
+    if (_impl->dataSockfd == -1 && !co_await openPassive())
+        co_return false;
+
+    auto reply = co_await command("RETR " + remotePath + "\r\n");
+    if (reply.replyClass != POSITIVE_PRELIMINARY) {
+        _impl->closeData();
+        co_return false;
+    }
+
+    // read until the server closes the data connection, each wait is cut to what is left of the transfer timeout
+    const auto &timeouts = _impl->timeouts;
+    auto deadline = Impl::Clock::now() + timeouts.transfer;
+    std::vector<Byte> chunk(DATA_CHUNK_SIZE);
+    uint64_t received = 0;
+    bool sinkStopped = false;
+    _impl->transferLimit.refill();
+    _impl->progress.start(0);
+    try {
+        while (true) {
+            auto rn = recv(_impl->dataSockfd, chunk.data(), chunk.size(), 0);
+            if (rn > 0) {
+                received += static_cast<uint64_t>(rn);
+                if (!sink(chunk.data(), static_cast<size_t>(rn))) {
+                    sinkStopped = true;
+                    break;
+                }
+
+                co_await _impl->countTransferred(static_cast<size_t>(rn));
+                if (timeouts.transfer.count() != 0 && Impl::Clock::now() >= deadline)
+                    throw TimeoutException("transferring data");
+            }
+            else if (rn == 0)
+                break;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                auto wait = timeouts.idle;
+                bool transferLimited = false;
+                if (timeouts.transfer.count() != 0) {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Impl::Clock::now());
+                    if (left.count() <= 0)
+                        left = std::chrono::milliseconds(1);
+
+                    if (wait.count() == 0 || left < wait) {
+                        wait = left;
+                        transferLimited = true;
+                    }
+                }
+
+                SocketAwaiter ready(_impl->loop, _impl->dataSockfd, EPOLLIN, wait);
+                if (co_await ready == 0)
+                    throw TimeoutException(transferLimited ? "transferring data" : "reading data connection");
+            }
+            else if (errno != EINTR)
+                throw SocketException();
+        }
+    } catch (const SocketException &) {
+        // a failed transfer is reported done as well, so whatever draws the progress ends its line
+        _impl->closeData();
+        _impl->progress.finish(0);
+        throw;
+    }
+
+    _impl->progress.finish(received);
+    _impl->closeData();
+    logDateTime(*_impl->logger) << "Received " << received << " bytes from host " << _impl->hostname << " through data connection" << std::endl;
+
+    reply = co_await readReply();
+    co_return !sinkStopped && reply.replyClass == POSITIVE_COMPLETION;
+}
+
+
+CoTask<void> CoFtpService::quit() {
+    co_await command("QUIT\r\n");
+    close();
+}
+
+
+const FtpCtrlReply &CoFtpService::lastReply() const {
+    return _impl->lastReply;
+}
+
+
+void CoFtpService::close() {
+    _impl->closeData();
+    if (_impl->ctrlSockfd == -1)
+        return;
+
+    ::close(_impl->ctrlSockfd);
+    _impl->ctrlSockfd = -1;
+    logDateTime(*_impl->logger) << "Closed control connection with host " << _impl->hostname << std::endl;
+}
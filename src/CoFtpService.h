@@ -0,0 +1,137 @@
+#ifndef COFTPSERVICE_H
+#define COFTPSERVICE_H
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include "FtpService.h"
+#include "SocketOptions.h"
+#include "TokenBucket.h"
+#include "TransferProgress.h"
+#include "EventLoop.h"
+#include "CoTask.h"
+
+
+/*
+ * CoFtpService class
+ * Awaitable counterpart of FtpService built on C++20 coroutines. Every operation suspends the calling
+ * coroutine instead of blocking the thread, and the event loop resumes it once the socket is ready, so
+ * thousands of transfers can be written as straight-line code on a few threads, e.g.
+ *
+ *     co_await ftp.connect(host, port);
+ *     co_await ftp.login(user, password);
+ *     co_await ftp.retr(path, sink);
+ *
+ * Each operation may be run to completion from blocking code with runBlocking. Data connections are
+ * always opened in passive mode. Connects race the addresses of the server, sockets are tuned, and
+ * transfers are paced and reported like those of FtpService, only by timers instead of sleeping. Throw SocketException if the connection fails, and TimeoutException
+ * if an operation does not complete within its timeout
+ */
+class CoFtpService {
+public:
+    CoFtpService(EventLoop &loop, std::ostream *log);
+
+    CoFtpService(const CoFtpService &) = delete;
+
+    CoFtpService &operator=(const CoFtpService &) = delete;
+
+    ~CoFtpService();
+
+    /*
+     * Set the timeouts of connect, idle read and write, and data transfer. The accept timeout is not
+     * used, since data connections are always passive
+     */
+    void setTimeouts(const FtpTimeouts &timeouts);
+
+    /*
+     * Get the timeouts of the socket operations
+     */
+    const FtpTimeouts &timeouts() const;
+
+    /*
+     * Set the delay between the connect attempts to the addresses of the server. It is
+     * FtpService::CONNECT_ATTEMPT_DELAY by default
+     */
+    void setConnectAttemptDelay(std::chrono::milliseconds delay);
+
+    /*
+     * Set the tuning of control and data sockets. It takes effect on the connections opened afterwards
+     */
+    void setSocketOptions(const SocketOptions &options);
+
+    /*
+     * Limit the rate of every data transfer in bytes per second, with bursts upto burst bytes. Rate 0
+     * turns off the limit. Each transfer starts with a full bucket
+     */
+    void setTransferRateLimit(uint64_t rate, uint64_t burst);
+
+    /*
+     * Share the rate limit with other ftp services, so that their transfers together stay under it
+     */
+    void setSharedRateLimit(std::shared_ptr<TokenBucket> limit);
+
+    /*
+     * Report the progress of every data transfer to the callback, at most once per interval and once when
+     * the transfer is done or fails. A null callback turns off reporting
+     */
+    void setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval);
+
+    /*
+     * Connect to the ftp server and return its greeting reply. Only the host name lookup blocks. Throw
+     * ResolveException if the host name cannot be resolved
+     */
+    CoTask<FtpCtrlReply> connect(std::string hostname, uint16_t port);
+
+    /*
+     * Read the next complete control reply
+     */
+    CoTask<FtpCtrlReply> readReply();
+
+    /*
+     * Send the command, which must end with CRLF, on the control connection
+     */
+    CoTask<void> sendCommand(std::string cmd);
+
+    /*
+     * Send the command and read its reply
+     */
+    CoTask<FtpCtrlReply> command(std::string cmd);
+
+    /*
+     * Log in and switch to binary type. Function returns false if the server refuses any step
+     */
+    CoTask<bool> login(std::string user, std::string password);
+
+    /*
+     * Open passive data connection with PASV or EPSV. Function returns false if the server refuses
+     */
+    CoTask<bool> openPassive();
+
+    /*
+     * Retrieve the remote file and pass its data to the sink as it arrives. A passive data connection
+     * is opened first if there is none. Function returns false if the server refuses the transfer,
+     * the transfer fails or the sink stops it
+     */
+    CoTask<bool> retr(std::string remotePath, DataSink sink);
+
+    /*
+     * Send QUIT command and close the control connection
+     */
+    CoTask<void> quit();
+
+    /*
+     * Get the last control reply received
+     */
+    const FtpCtrlReply &lastReply() const;
+
+    /*
+     * Close the control and data connection without QUIT
+     */
+    void close();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+#endif // COFTPSERVICE_H
@@ -0,0 +1,276 @@
+#ifndef COTASK_H
+#define COTASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <cstdint>
+#include <errno.h>
+#include "EventLoop.h"
+#include "FtpService.h"
+
+
+/*
+ * CoTaskPromiseBase struct
+ * The part of the promise shared by every CoTask: the coroutine awaiting the task, which is resumed
+ * when the task finishes, and the exception the task ended with
+ */
+struct CoTaskPromiseBase {
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            auto continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    bool started = false;
+};
+
+
+template<typename T>
+struct CoTaskPromise : CoTaskPromiseBase {
+    void return_value(T result) { value = std::move(result); }
+
+    T result() {
+        if (exception)
+            std::rethrow_exception(exception);
+
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+
+template<>
+struct CoTaskPromise<void> : CoTaskPromiseBase {
+    void return_void() {}
+
+    void result() {
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+
+/*
+ * CoTask class
+ * A lazy coroutine that returns T. The task starts when it is awaited or when start is called, so
+ * several tasks can be started before they are awaited to run concurrently. The task resumes its
+ * awaiter when it finishes and owns the coroutine frame
+ */
+template<typename T>
+class CoTask {
+public:
+    struct promise_type : CoTaskPromise<T> {
+        CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+
+    CoTask(CoTask &&other) noexcept
+        : _handle{std::exchange(other._handle, nullptr)}
+    {}
+
+    CoTask(const CoTask &) = delete;
+
+    CoTask &operator=(const CoTask &) = delete;
+
+    ~CoTask() {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    /*
+     * Run the task until its first suspension
+     */
+    void start() {
+        _handle.promise().started = true;
+        _handle.resume();
+    }
+
+    /*
+     * Check if the task has finished
+     */
+    bool done() const {
+        return _handle.done();
+    }
+
+    /*
+     * Get the result of the finished task, or rethrow the exception it ended with
+     */
+    T result() {
+        return _handle.promise().result();
+    }
+
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            bool await_ready() noexcept { return handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                // a task that is already started is waiting for its socket, it only needs to know who to resume
+                handle.promise().continuation = awaiting;
+                if (handle.promise().started)
+                    return std::noop_coroutine();
+
+                handle.promise().started = true;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        return Awaiter{_handle};
+    }
+
+private:
+    explicit CoTask(std::coroutine_handle<promise_type> handle)
+        : _handle{handle}
+    {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+
+/*
+ * SocketAwaiter class
+ * Suspend the coroutine until the socket is ready for the epoll events, or until the timeout passes.
+ * The coroutine resumes with the ready events, which are 0 if the wait timed out. A timeout of 0 waits
+ * forever. The socket is watched by the event loop only while the coroutine waits, and stops being
+ * watched if the coroutine is destroyed first
+ */
+class SocketAwaiter {
+public:
+    SocketAwaiter(EventLoop &loop, int fd, uint32_t events)
+        : SocketAwaiter(loop, fd, events, std::chrono::milliseconds(0))
+    {}
+
+    SocketAwaiter(EventLoop &loop, int fd, uint32_t events, std::chrono::milliseconds timeout)
+        : _loop{loop}, _fd{fd}, _events{events}, _timeout{timeout}, _ready{0}, _watching{false}, _timer{0}
+    {}
+
+    SocketAwaiter(const SocketAwaiter &) = delete;
+
+    SocketAwaiter &operator=(const SocketAwaiter &) = delete;
+
+    ~SocketAwaiter() {
+        stopWatching();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        _loop.add(_fd, _events, [this, handle](uint32_t events) {
+            _ready = events;
+            stopWatching();
+            handle.resume();
+        });
+        _watching = true;
+
+        if (_timeout.count() != 0) {
+            _timer = _loop.addTimer(_timeout, [this, handle]() {
+                _timer = 0;
+                stopWatching();
+                handle.resume();
+            });
+        }
+    }
+
+    uint32_t await_resume() const noexcept { return _ready; }
+
+private:
+    void stopWatching() {
+        if (_watching) {
+            _loop.remove(_fd);
+            _watching = false;
+        }
+
+        if (_timer != 0) {
+            _loop.cancelTimer(_timer);
+            _timer = 0;
+        }
+    }
+
+    EventLoop &_loop;
+    int _fd;
+    uint32_t _events;
+    std::chrono::milliseconds _timeout;
+    uint32_t _ready;
+    bool _watching;
+    EventLoop::TimerId _timer;
+};
+
+
+/*
+ * TimerAwaiter class
+ * Suspend the coroutine for the delay without blocking the event loop, e.g. to pay the debt of a rate
+ * limit. The timer is cancelled if the coroutine is destroyed first
+ */
+class TimerAwaiter {
+public:
+    TimerAwaiter(EventLoop &loop, std::chrono::milliseconds delay)
+        : _loop{loop}, _delay{delay}, _timer{0}
+    {}
+
+    TimerAwaiter(const TimerAwaiter &) = delete;
+
+    TimerAwaiter &operator=(const TimerAwaiter &) = delete;
+
+    ~TimerAwaiter() {
+        if (_timer != 0)
+            _loop.cancelTimer(_timer);
+    }
+
+    bool await_ready() const noexcept { return _delay.count() <= 0; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        _timer = _loop.addTimer(_delay, [this, handle]() {
+            _timer = 0;
+            handle.resume();
+        });
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    EventLoop &_loop;
+    std::chrono::milliseconds _delay;
+    EventLoop::TimerId _timer;
+};
+
+
+/*
+ * Run the task on the event loop until it finishes and return its result. It is the blocking wrapper
+ * around any coroutine of the API
+ */
+template<typename T>
+T runBlocking(EventLoop &loop, CoTask<T> task) {
+    task.start();
+    while (!task.done()) {
+        // nothing left to wake the task up
+        if (loop.size() == 0 && loop.timerCount() == 0) {
+            errno = EDEADLK;
+            throw SocketException();
+        }
+
+        loop.runOnce(-1);
+    }
+
+    return task.result();
+}
+
+#endif // COTASK_H
@@ -0,0 +1,212 @@
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include "ConnectRace.h"
+#include "FtpService.h"
+
+
+std::vector<SocketAddress> resolveHost(const std::string &host, const std::string &port) {
+    addrinfo hint, *ipAddrHdr = nullptr;
+    memset(&hint, 0, sizeof(hint));
+    hint.ai_family   = AF_UNSPEC;
+    hint.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(host.c_str(), port.c_str(), &hint, &ipAddrHdr);
+    if (status != 0)
+        throw ResolveException(status);
+
+    std::vector<SocketAddress> preferred, others;
+    for (addrinfo *ipAddr = ipAddrHdr; ipAddr; ipAddr = ipAddr->ai_next) {
+        SocketAddress address;
+        memset(&address.first, 0, sizeof(address.first));
+        memcpy(&address.first, ipAddr->ai_addr, ipAddr->ai_addrlen);
+        address.second = ipAddr->ai_addrlen;
+        if (preferred.empty() || address.first.ss_family == preferred.front().first.ss_family)
+            preferred.push_back(address);
+        else
+            others.push_back(address);
+    }
+    freeaddrinfo(ipAddrHdr);
+
+    // the order within each family is kept
+    std::vector<SocketAddress> addresses;
+    for (size_t i = 0; i < preferred.size() || i < others.size(); ++i) {
+        if (i < preferred.size())
+            addresses.push_back(preferred[i]);
+        if (i < others.size())
+            addresses.push_back(others[i]);
+    }
+
+    return addresses;
+}
+
+
+ConnectRace::ConnectRace(const std::vector<SocketAddress> &addresses, std::chrono::milliseconds attemptDelay, SocketSetup setup)
+    : _addresses{addresses}, _attemptDelay{attemptDelay}, _setup{std::move(setup)}, _next{0}, _nextStart{Clock::now()},
+      _winner{-1}, _winnerIndex{0}, _lastError{EHOSTUNREACH}
+{}
+
+
+ConnectRace::~ConnectRace() {
+    for (const auto &attempt : _attempts)
+        close(attempt.sockfd);
+}
+
+
+int ConnectRace::startNext() {
+    while (_winner == -1 && _next < _addresses.size() && (_attempts.empty() || Clock::now() >= _nextStart)) {
+        size_t index = _next++;
+        const auto &address = _addresses[index];
+        _nextStart = Clock::now() + _attemptDelay;
+
+        int sockfd = socket(address.first.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sockfd == -1) {
+            _lastError = errno;
+            _nextStart = Clock::now();
+            continue;
+        }
+
+        if (_setup)
+            _setup(sockfd);
+
+        if (connect(sockfd, reinterpret_cast<const sockaddr *>(&address.first), address.second) == 0) {
+            _attempts.push_back({sockfd, index});
+            _winner = sockfd;
+            _winnerIndex = index;
+            return sockfd;
+        }
+
+        if (errno == EINPROGRESS) {
+            _attempts.push_back({sockfd, index});
+            return sockfd;
+        }
+
+        // a failed attempt lets the next one start right away
+        _lastError = errno;
+        close(sockfd);
+        _nextStart = Clock::now();
+    }
+
+    return -1;
+}
+
+
+bool ConnectRace::check(int sockfd) {
+    auto attempt = std::find_if(_attempts.begin(), _attempts.end(), [sockfd](const Attempt &a) { return a.sockfd == sockfd; });
+    if (attempt == _attempts.end() || _winner != -1)
+        return sockfd == _winner;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+        _winner = sockfd;
+        _winnerIndex = attempt->index;
+        return true;
+    }
+
+    _lastError = err != 0 ? err : errno;
+    close(sockfd);
+    _attempts.erase(attempt);
+    _nextStart = Clock::now();
+    return false;
+}
+
+
+std::chrono::milliseconds ConnectRace::nextStartIn() const {
+    if (_winner != -1 || _next >= _addresses.size())
+        return std::chrono::milliseconds(-1);
+
+    if (_attempts.empty())
+        return std::chrono::milliseconds(0);
+
+    // rounded up, so a wait of that long does not wake up before the attempt is due
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(_nextStart - Clock::now() + std::chrono::milliseconds(1)
+                                                                      - Clock::duration(1));
+    return std::max(wait, std::chrono::milliseconds(0));
+}
+
+
+std::vector<int> ConnectRace::attempts() const {
+    std::vector<int> sockfds;
+    for (const auto &attempt : _attempts)
+        sockfds.push_back(attempt.sockfd);
+
+    return sockfds;
+}
+
+
+bool ConnectRace::won() const {
+    return _winner != -1;
+}
+
+
+bool ConnectRace::failed() const {
+    return _winner == -1 && _attempts.empty() && _next >= _addresses.size();
+}
+
+
+int ConnectRace::lastError() const {
+    return _lastError;
+}
+
+
+int ConnectRace::take(size_t &index) {
+    closeLosers();
+    _attempts.clear();
+    index = _winnerIndex;
+    return std::exchange(_winner, -1);
+}
+
+
+int ConnectRace::run(std::chrono::milliseconds timeout, size_t &index) {
+    auto deadline = Clock::now() + timeout;
+    std::vector<pollfd> pollfds;
+    while (true) {
+        while (startNext() != -1 && _winner == -1) {}
+
+        if (_winner != -1)
+            return take(index);
+
+        if (failed()) {
+            errno = _lastError;
+            throw SocketException();
+        }
+
+        int wait = static_cast<int>(nextStartIn().count());
+
+        // every attempt shares the timeout
+        if (timeout.count() > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (left <= 0)
+                throw TimeoutException("connecting");
+
+            wait = wait == -1 ? static_cast<int>(left) : std::min(wait, static_cast<int>(left));
+        }
+
+        pollfds.clear();
+        for (const auto &attempt : _attempts)
+            pollfds.push_back({attempt.sockfd, POLLOUT, 0});
+
+        if (poll(pollfds.data(), pollfds.size(), wait) == -1) {
+            if (errno == EINTR)
+                continue;
+
+            throw SocketException();
+        }
+
+        for (const auto &ready : pollfds) {
+            if (ready.revents != 0 && check(ready.fd))
+                return take(index);
+        }
+    }
+}
+
+
+void ConnectRace::closeLosers() {
+    for (const auto &attempt : _attempts) {
+        if (attempt.sockfd != _winner)
+            close(attempt.sockfd);
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef CONNECTRACE_H
+#define CONNECTRACE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <utility>
+
+
+/*
+ * Socket address with its length, as getaddrinfo returns it
+ */
+using SocketAddress = std::pair<sockaddr_storage, socklen_t>;
+
+
+/*
+ * Resolve the host name to the addresses of its stream sockets, ordered so that the address families
+ * alternate, starting with the family of the first address as described in RFC 8305 section 4.
+ * Throw ResolveException if the host name cannot be resolved
+ */
+std::vector<SocketAddress> resolveHost(const std::string &host, const std::string &port);
+
+
+/*
+ * ConnectRace class
+ * Race non-blocking connects to the addresses as described in RFC 8305 section 5. A new attempt starts
+ * every attempt delay, or as soon as an attempt fails, and the attempts started before keep going. The
+ * first socket that connects wins and the other attempts are closed. The race does not wait by itself:
+ * run drives it with poll, and an event loop drives it by watching the attempts for writing, calling
+ * check when they are ready and startNext when the next attempt is due. Sockets not taken are closed
+ * when the race goes out of scope
+ */
+class ConnectRace {
+public:
+    /*
+     * Setup is called on every socket before it connects, e.g. to tune its buffers
+     */
+    using SocketSetup = std::function<void(int sockfd)>;
+
+    ConnectRace(const std::vector<SocketAddress> &addresses, std::chrono::milliseconds attemptDelay, SocketSetup setup);
+
+    ConnectRace(const ConnectRace &) = delete;
+
+    ConnectRace &operator=(const ConnectRace &) = delete;
+
+    ~ConnectRace();
+
+    /*
+     * Start the next attempt if it is due: the attempt delay is over, or no attempt is in flight.
+     * Function returns the non-blocking socket of the attempt, which has to be watched until it is
+     * writable, or -1 if no attempt starts. An attempt that connects at once wins right away
+     */
+    int startNext();
+
+    /*
+     * Check the attempt once its socket is ready. A failed attempt is closed and lets the next one
+     * start right away. Function returns true if the attempt connected and won the race
+     */
+    bool check(int sockfd);
+
+    /*
+     * Get the time until the next attempt is due, or -1 milliseconds if no address is left
+     */
+    std::chrono::milliseconds nextStartIn() const;
+
+    /*
+     * Get the sockets of the attempts in flight, including the winner until it is taken
+     */
+    std::vector<int> attempts() const;
+
+    /*
+     * Check if an attempt has won the race
+     */
+    bool won() const;
+
+    /*
+     * Check if every attempt has failed and no address is left. errno of the last attempt is kept by
+     * lastError
+     */
+    bool failed() const;
+
+    int lastError() const;
+
+    /*
+     * Take the winning socket, still in non-blocking mode, with the index of its address. The other
+     * attempts are closed
+     */
+    int take(size_t &index);
+
+    /*
+     * Run the whole race with poll. Function returns the winning socket in non-blocking mode with the
+     * index of its address. Throw TimeoutException if no attempt connects within the timeout, where 0
+     * waits forever, and SocketException with the error of the last attempt if every attempt fails
+     */
+    int run(std::chrono::milliseconds timeout, size_t &index);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Attempt {
+        int sockfd;
+        size_t index;
+    };
+
+    /*
+     * Helper function to close every attempt except the winner
+     */
+    void closeLosers();
+
+    std::vector<SocketAddress> _addresses;
+    std::chrono::milliseconds _attemptDelay;
+    SocketSetup _setup;
+    std::vector<Attempt> _attempts;
+    size_t _next;
+    Clock::time_point _nextStart;
+    int _winner;
+    size_t _winnerIndex;
+    int _lastError;
+};
+
+#endif // CONNECTRACE_H
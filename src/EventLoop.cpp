@@ -0,0 +1,190 @@
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <unordered_map>
+#include <vector>
+#include <set>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include "EventLoop.h"
+#include "FtpService.h"
+
+
+static const int EVENTS_PER_WAIT = 256;
+
+
+struct EventLoop::Impl {
+    using Clock = std::chrono::steady_clock;
+
+
+    /*
+     * Helper function to get the milliseconds until the next timer is due, rounded up so the wait does
+     * not end before it. Function returns -1 if there is no timer
+     */
+    int msUntilNextTimer() const {
+        if (timerQueue.empty())
+            return -1;
+
+        auto wait = timerQueue.begin()->first - Clock::now();
+        if (wait <= Clock::duration::zero())
+            return 0;
+
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(wait + std::chrono::milliseconds(1) - Clock::duration(1));
+        return static_cast<int>(std::min<std::chrono::milliseconds::rep>(ms.count(), std::numeric_limits<int>::max()));
+    }
+
+
+    /*
+     * Helper function to call the handlers of the timers that are due. Timers added by the handlers
+     * fire in a later round. Function returns the number of handlers called
+     */
+    size_t fireTimers() {
+        std::vector<TimerId> due;
+        auto now = Clock::now();
+        for (auto timer = timerQueue.begin(); timer != timerQueue.end() && timer->first <= now; ++timer)
+            due.push_back(timer->second);
+
+        size_t called = 0;
+        for (TimerId id : due) {
+            // an earlier handler of this round may have cancelled the timer
+            auto timer = timers.find(id);
+            if (timer == timers.end())
+                continue;
+
+            TimerHandler handler = std::move(timer->second.second);
+            timerQueue.erase({timer->second.first, id});
+            timers.erase(timer);
+            handler();
+            ++called;
+        }
+
+        return called;
+    }
+
+
+    int epollfd;
+
+    // handlers are shared so a handler that removes its own socket is not destroyed while it runs
+    std::unordered_map<int, std::shared_ptr<Handler>> handlers;
+    std::vector<epoll_event> events;
+
+    // sockets removed while the handlers of a round run; their number may already belong to a new socket
+    std::vector<int> removed;
+
+    // timers ordered by the time they are due, and their handlers by id
+    std::set<std::pair<Clock::time_point, TimerId>> timerQueue;
+    std::unordered_map<TimerId, std::pair<Clock::time_point, TimerHandler>> timers;
+    TimerId lastTimerId = 0;
+};
+
+
+EventLoop::EventLoop() {
+    _impl = std::make_unique<Impl>();
+    _impl->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_impl->epollfd == -1)
+        throw SocketException();
+
+    _impl->events.resize(EVENTS_PER_WAIT);
+}
+
+
+EventLoop::~EventLoop() {
+    close(_impl->epollfd);
+}
+
+
+void EventLoop::add(int fd, uint32_t events, Handler handler) {
+    epoll_event event{};
+    event.events  = events;
+    event.data.fd = fd;
+    if (epoll_ctl(_impl->epollfd, EPOLL_CTL_ADD, fd, &event) == -1)
+        throw SocketException();
+
+    _impl->handlers[fd] = std::make_shared<Handler>(std::move(handler));
+}
+
+
+void EventLoop::modify(int fd, uint32_t events) {
+    epoll_event event{};
+    event.events  = events;
+    event.data.fd = fd;
+    if (epoll_ctl(_impl->epollfd, EPOLL_CTL_MOD, fd, &event) == -1)
+        throw SocketException();
+}
+
+
+void EventLoop::remove(int fd) {
+    if (_impl->handlers.erase(fd) == 0)
+        return;
+
+    epoll_ctl(_impl->epollfd, EPOLL_CTL_DEL, fd, nullptr);
+    _impl->removed.push_back(fd);
+}
+
+
+size_t EventLoop::size() const {
+    return _impl->handlers.size();
+}
+
+
+EventLoop::TimerId EventLoop::addTimer(std::chrono::milliseconds delay, TimerHandler handler) {
+    TimerId id = ++_impl->lastTimerId;
+    auto due = Impl::Clock::now() + delay;
+    _impl->timerQueue.insert({due, id});
+    _impl->timers[id] = {due, std::move(handler)};
+    return id;
+}
+
+
+void EventLoop::cancelTimer(TimerId id) {
+    auto timer = _impl->timers.find(id);
+    if (timer == _impl->timers.end())
+        return;
+
+    _impl->timerQueue.erase({timer->second.first, id});
+    _impl->timers.erase(timer);
+}
+
+
+size_t EventLoop::timerCount() const {
+    return _impl->timers.size();
+}
+
+
+size_t EventLoop::runOnce(int timeoutMs) {
+    int timerMs = _impl->msUntilNextTimer();
+    if (timerMs != -1)
+        timeoutMs = timeoutMs == -1 ? timerMs : std::min(timeoutMs, timerMs);
+
+    int ready;
+    do {
+        ready = epoll_wait(_impl->epollfd, _impl->events.data(), static_cast<int>(_impl->events.size()), timeoutMs);
+    } while (ready == -1 && errno == EINTR);
+
+    if (ready == -1)
+        throw SocketException();
+
+    size_t called = 0;
+    _impl->removed.clear();
+    for (int i = 0; i < ready; ++i) {
+        // an earlier handler of this round may have removed the socket
+        int fd = _impl->events[i].data.fd;
+        auto handler = _impl->handlers.find(fd);
+        if (handler == _impl->handlers.end() || std::find(_impl->removed.begin(), _impl->removed.end(), fd) != _impl->removed.end())
+            continue;
+
+        auto keepAlive = handler->second;
+        (*keepAlive)(_impl->events[i].events);
+        ++called;
+    }
+
+    called += _impl->fireTimers();
+    return called;
+}
+
+
+void EventLoop::run() {
+    while (!_impl->handlers.empty() || !_impl->timers.empty())
+        runOnce(-1);
+}
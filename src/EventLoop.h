@@ -0,0 +1,94 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+
+/*
+ * EventLoop class
+ * Wait on many sockets at once with epoll and call back the handler of every socket that is ready,
+ * so that one thread can drive hundreds of non-blocking sessions. Timers call back their handler once
+ * after a delay, e.g. for the timeouts of the sessions. Handlers may add, modify or remove any socket
+ * or timer, including their own, while they are called. Throw SocketException if epoll fails
+ */
+class EventLoop {
+public:
+    /*
+     * Handler is called with the epoll events that are ready on the socket
+     */
+    using Handler = std::function<void(uint32_t events)>;
+
+    /*
+     * Timer handler is called once when the timer is due
+     */
+    using TimerHandler = std::function<void()>;
+
+    /*
+     * Id of a timer. Id 0 is never used, so it can stand for no timer
+     */
+    using TimerId = uint64_t;
+
+    EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    ~EventLoop();
+
+    /*
+     * Start watching the socket for the events
+     */
+    void add(int fd, uint32_t events, Handler handler);
+
+    /*
+     * Change the events watched on the socket
+     */
+    void modify(int fd, uint32_t events);
+
+    /*
+     * Stop watching the socket. It must be called before the socket is closed
+     */
+    void remove(int fd);
+
+    /*
+     * Get the number of sockets being watched
+     */
+    size_t size() const;
+
+    /*
+     * Call the handler once after the delay. Function returns the id of the timer
+     */
+    TimerId addTimer(std::chrono::milliseconds delay, TimerHandler handler);
+
+    /*
+     * Cancel the timer. A timer that has already fired or is cancelled is ignored
+     */
+    void cancelTimer(TimerId id);
+
+    /*
+     * Get the number of timers that have not fired yet
+     */
+    size_t timerCount() const;
+
+    /*
+     * Wait upto timeoutMs milliseconds, or forever if it is -1, and call the handlers of the ready sockets
+     * and of the timers that are due. The wait ends early when the next timer is due.
+     * Function returns the number of handlers called
+     */
+    size_t runOnce(int timeoutMs);
+
+    /*
+     * Call the handlers of ready sockets and due timers until no socket is watched and no timer is left
+     */
+    void run();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+#endif // EVENTLOOP_H
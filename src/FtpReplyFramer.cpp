@@ -0,0 +1,156 @@
+#include <string.h>
+#include <algorithm>
+#include "FtpReplyFramer.h"
+
+
+static const size_t FRAMER_BUFFER_SIZE_MIN = 2048;
+
+
+FtpReplyFramer::FtpReplyFramer()
+    : _buf(FRAMER_BUFFER_SIZE_MIN), _begin{0}, _end{0}, _scan{0}, _consume{0}, _code{0}, _firstCode{0}, _multiLine{false}
+{}
+
+
+char *FtpReplyFramer::prepare(size_t minSize, size_t &available) {
+    dropFramedReply();
+
+    if (_buf.size() - _end < minSize) {
+        // move the unframed bytes to the front of the buffer and grow the buffer if still not enough.
+        // Scan state is kept relative to the beginning of the reply, so it survives the move
+        std::copy(_buf.begin() + static_cast<std::ptrdiff_t>(_begin), _buf.begin() + static_cast<std::ptrdiff_t>(_end), _buf.begin());
+        _end  -= _begin;
+        _begin = 0;
+
+        if (_buf.size() - _end < minSize)
+            _buf.resize(std::max(_buf.size() * 2, _end + minSize));
+    }
+
+    available = _buf.size() - _end;
+    return _buf.data() + _end;
+}
+
+
+void FtpReplyFramer::commit(size_t size) {
+    _end += size;
+}
+
+
+bool FtpReplyFramer::next() {
+    dropFramedReply();
+
+    // continue scanning from the first line that was not complete last time
+    const char *reply = _buf.data() + _begin;
+    size_t size = _end - _begin;
+    while (_scan < size) {
+        auto eol = static_cast<const char *>(memchr(reply + _scan, '\n', size - _scan));
+        if (!eol)
+            return false;
+
+        const char *line = reply + _scan;
+        size_t lineSize = static_cast<size_t>(eol - line) + 1;
+        _spans.push_back({_scan, lineSize});
+        _scan += lineSize;
+
+        unsigned lineCode;
+        bool hasCode = parseCode(line, lineSize, lineCode);
+        if (_spans.size() == 1) {
+            // first line decides if the reply spans multiple lines: "ddd-" starts multi-line reply
+            _firstCode = hasCode ? lineCode : 0;
+            _multiLine = hasCode && line[3] == '-';
+        }
+
+        // multi-line reply ends at the line that starts with the same code not followed by '-'
+        bool lastLine = !_multiLine || (_spans.size() > 1 && hasCode && lineCode == _firstCode && line[3] != '-');
+        if (lastLine) {
+            _code    = _firstCode;
+            _consume = _scan;
+            for (const auto &span : _spans)
+                _lines.push_back({reply + span.first, span.second});
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+unsigned FtpReplyFramer::code() const {
+    return _code;
+}
+
+
+FtpReplyClass FtpReplyFramer::replyClass() const {
+    return replyClassOf(_code);
+}
+
+
+const std::vector<FtpReplyLine> &FtpReplyFramer::lines() const {
+    return _lines;
+}
+
+
+FtpReplyLine FtpReplyFramer::text() const {
+    return {_buf.data() + _begin, _consume};
+}
+
+
+void FtpReplyFramer::takeRemaining(std::string &remaining) {
+    dropFramedReply();
+    remaining.assign(_buf.data() + _begin, _end - _begin);
+    reset();
+}
+
+
+void FtpReplyFramer::reset() {
+    _buf.resize(FRAMER_BUFFER_SIZE_MIN);
+    _begin   = 0;
+    _end     = 0;
+    _scan    = 0;
+    _consume = 0;
+    _code    = 0;
+    _spans.clear();
+    _lines.clear();
+}
+
+
+void FtpReplyFramer::dropFramedReply() {
+    _lines.clear();
+    if (_consume == 0)
+        return;
+
+    _begin  += _consume;
+    _consume = 0;
+    _scan    = 0;
+    _spans.clear();
+
+    // nothing left, start from the front of the buffer again
+    if (_begin == _end)
+        _begin = _end = 0;
+}
+
+
+FtpReplyClass FtpReplyFramer::replyClassOf(unsigned code) {
+    unsigned digit = code / 100;
+    if (code < 100 || code > 599)
+        return INVALID_REPLY;
+
+    return static_cast<FtpReplyClass>(digit);
+}
+
+
+bool FtpReplyFramer::parseCode(const char *line, size_t size, unsigned &code) {
+    // the code must be followed by at least one more char, which is '-', ' ' or the line terminator
+    if (size < 4)
+        return false;
+
+    code = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        if (line[i] < '0' || line[i] > '9')
+            return false;
+
+        code = code * 10 + static_cast<unsigned>(line[i] - '0');
+    }
+
+    return true;
+}
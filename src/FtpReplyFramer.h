@@ -0,0 +1,108 @@
+#ifndef FTPREPLYFRAMER_H
+#define FTPREPLYFRAMER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "FtpService.h"
+
+
+/*
+ * FtpReplyLine struct
+ * View of one line of the reply inside the framer buffer, including the line terminator
+ */
+struct FtpReplyLine {
+    const char *data;
+    size_t size;
+};
+
+
+/*
+ * FtpReplyFramer class
+ * Assemble complete control replies, single or multi-line as defined in RFC 959 section 4.2,
+ * from the bytes received on the control connection. The bytes are read straight into the framer
+ * buffer, which is reused for every reply, and the lines of the framed reply are exposed as views
+ * into that buffer. The views are valid until the next call to prepare or next
+ */
+class FtpReplyFramer {
+public:
+    FtpReplyFramer();
+
+    /*
+     * Get the free space at the end of the buffer to receive more bytes into.
+     * The buffer grows if less than minSize bytes are free
+     */
+    char *prepare(size_t minSize, size_t &available);
+
+    /*
+     * Mark size bytes of the free space returned by prepare as received
+     */
+    void commit(size_t size);
+
+    /*
+     * Frame the next complete reply from the received bytes. Function returns false if
+     * more bytes are needed
+     */
+    bool next();
+
+    /*
+     * Get the reply code of the framed reply. It is 0 if the reply does not start with a code
+     */
+    unsigned code() const;
+
+    /*
+     * Get the reply class of the framed reply
+     */
+    FtpReplyClass replyClass() const;
+
+    /*
+     * Get the lines of the framed reply
+     */
+    const std::vector<FtpReplyLine> &lines() const;
+
+    /*
+     * Get the whole text of the framed reply
+     */
+    FtpReplyLine text() const;
+
+    /*
+     * Take the bytes that are received but not framed into a reply. It is used when the
+     * connection is closed in the middle of a reply
+     */
+    void takeRemaining(std::string &remaining);
+
+    /*
+     * Discard every received byte
+     */
+    void reset();
+
+    /*
+     * Get the reply class of the reply code
+     */
+    static FtpReplyClass replyClassOf(unsigned code);
+
+private:
+    /*
+     * Helper function to drop the bytes of the reply that is framed by the last call to next
+     */
+    void dropFramedReply();
+
+    /*
+     * Helper function to parse the 3 digits reply code at the beginning of the line. Function returns
+     * false if the line does not start with a reply code
+     */
+    static bool parseCode(const char *line, size_t size, unsigned &code);
+
+    std::vector<char> _buf;
+    size_t _begin;
+    size_t _end;
+    size_t _scan;
+    size_t _consume;
+    unsigned _code;
+    unsigned _firstCode;
+    bool _multiLine;
+    std::vector<std::pair<size_t, size_t>> _spans;
+    std::vector<FtpReplyLine> _lines;
+};
+
+#endif // FTPREPLYFRAMER_H
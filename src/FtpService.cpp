@@ -2,6 +2,9 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/in.h>
@@ -16,19 +19,68 @@
 #include <bitset>
 #include <algorithm>
 #include <iomanip>
+#include <chrono>
+#include <utility>
+#include <zlib.h>
 #include "Utility.h"
 #include "FtpService.h"
+#include "IoUring.h"
+#include "FtpReplyFramer.h"
+#include "ConnectRace.h"
 
 
 static const int BUFFER_SIZE_MIN  = 2048;
+static const int DATA_CHUNK_SIZE  = 65536;
 static const int LISTEN_QUEUE_MAX = 100;
 
+// listening sockets kept for active data connections, used in turn
+static const size_t KEPT_LISTENERS = 4;
+
+// one sendfile call moves at most this many bytes, so the transfer deadline and progress are checked during uploads
+static const size_t SENDFILE_CHUNK_MAX = 16 * DATA_CHUNK_SIZE;
+
+// representation type of a new control connection, RFC 959 section 3.1.1.1
+static const char DEFAULT_TRANSFER_TYPE = 'A';
+
+// block header of RFC 959 section 3.4.2: one descriptor byte and two bytes of byte count
+static const size_t BLOCK_HEADER_SIZE      = 3;
+static const size_t BLOCK_SIZE_MAX         = 65535;
+static const Byte   BLOCK_DESCRIPTOR_EOF   = 64;
+static const Byte   BLOCK_DESCRIPTOR_MARK  = 16;
+
+constexpr std::chrono::milliseconds FtpService::CONNECT_ATTEMPT_DELAY;
+
+constexpr std::chrono::milliseconds FtpService::TIMEOUT_MAX;
+
+const FtpTimeouts FtpService::DEFAULT_TIMEOUTS = {
+    std::chrono::seconds(30),
+    std::chrono::seconds(30),
+    std::chrono::seconds(120),
+    std::chrono::seconds(0),
+};
+
 struct FtpService::Impl {
+    using Address = SocketAddress;
+
 
     /*
      * Helper function to accept comming request
      */
     void acceptHost(int listenSockfd, int &sockfd) {
+        // the server may never connect back, e.g. when a firewall drops the connection
+        if (timeouts.accept.count() > 0) {
+            pollfd pending{listenSockfd, POLLIN, 0};
+            int ready;
+            do {
+                ready = poll(&pending, 1, static_cast<int>(timeouts.accept.count()));
+            } while (ready == -1 && errno == EINTR);
+
+            if (ready == -1)
+                throw SocketException();
+            if (ready == 0)
+                throw TimeoutException("accepting data connection");
+        }
+
         sockaddr_storage peerAddr;
         socklen_t len = sizeof(peerAddr);
         sockfd = accept(listenSockfd, reinterpret_cast<sockaddr *>(&peerAddr), &len);
@@ -37,6 +89,76 @@ struct FtpService::Impl {
     }
 
 
+    /*
+     * Helper function to close the connections that are waiting on a kept listening socket. They are left
+     * over from transfers that failed before the connection was accepted, and must not be taken for the next one
+     */
+    void drainListener(int listenSockfd) {
+        pollfd pending{listenSockfd, POLLIN, 0};
+        while (poll(&pending, 1, 0) == 1 && (pending.revents & POLLIN)) {
+            int sockfd = accept(listenSockfd, nullptr, nullptr);
+            if (sockfd == -1)
+                break;
+
+            close(sockfd);
+        }
+    }
+
+
+    /*
+     * Helper function to check if the socket is one of the kept listening sockets
+     */
+    bool isKeptListener(int sockfd) const {
+        return std::find(keptListenSockfds.begin(), keptListenSockfds.end(), sockfd) != keptListenSockfds.end();
+    }
+
+
+    /*
+     * Helper function to get the number of listening sockets to keep. A port range smaller than
+     * KEPT_LISTENERS is held by fewer sockets, since every port of it can only be bound once
+     */
+    size_t keptListenersMax() const {
+        if (activePortMin == 0)
+            return KEPT_LISTENERS;
+
+        return std::min<size_t>(KEPT_LISTENERS, activePortMax - activePortMin + 1);
+    }
+
+
+    /*
+     * Helper function to take the next kept listening socket in turn for the data connection of the transfer
+     */
+    void useKeptListener(uint16_t &port) {
+        int listenSockfd = keptListenSockfds[nextKeptListener % keptListenSockfds.size()];
+        nextKeptListener = (nextKeptListener + 1) % keptListenSockfds.size();
+        drainListener(listenSockfd);
+        port = localPort(listenSockfd);
+        dataSockfd = listenSockfd;
+        activeDataMode = true;
+    }
+
+
+    /*
+     * Helper function to close the kept listening sockets
+     */
+    void closeKeptListeners() {
+        if (keptListenSockfds.empty())
+            return;
+
+        if (isKeptListener(dataSockfd)) {
+            dataSockfd = -1;
+            activeDataMode = false;
+        }
+
+        for (int listenSockfd : keptListenSockfds)
+            close(listenSockfd);
+
+        keptListenSockfds.clear();
+        nextKeptListener = 0;
+        logDateTime(*logger) << "Closed kept listening sockets for active data connection" << std::endl;
+    }
+
+
     /*
      * Helper function to open connection to listen for comming request
      * This code refers from the example of http://man7.org/linux/man-pages/man3/getaddrinfo.3.html
@@ -49,8 +171,8 @@ struct FtpService::Impl {
         hint.ai_family = netProtocol == IPv4 ? AF_INET : AF_INET6;
         hint.ai_socktype = SOCK_STREAM;
         hint.ai_flags = AI_PASSIVE;
-        if ((stat = getaddrinfo(nullptr, port.c_str(), &hint, &ipAddrHdr)) == -1)
-            throw SocketException();
+        if ((stat = getaddrinfo(nullptr, port.c_str(), &hint, &ipAddrHdr)) != 0)
+            throw ResolveException(stat);
 
         // loop through all possible ip address to open socket
         addrinfo *ipAddr;
@@ -59,6 +181,9 @@ struct FtpService::Impl {
             if (sockfd == -1)
                 continue;
 
+            // accepted connections inherit the buffer sizes and congestion control of the listening socket
+            tuneDataSocket(sockfd);
+
             int reuse = 1;
             bool socketUnusable = setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int)) == -1 ||
                                   bind(sockfd, ipAddr->ai_addr, ipAddr->ai_addrlen)                 == -1 ||
@@ -84,66 +209,527 @@ struct FtpService::Impl {
 
 
     /*
-     * Helper function to connect to ftp server. Function return socket descriptor and protocol of the connection
-     * This code refers from the example of http://man7.org/linux/man-pages/man3/getaddrinfo.3.html
+     * Helper function to tune the socket of control connection
+     */
+    void tuneCtrlSocket(int sockfd) {
+        socketOptions.applyToCtrlSocket(sockfd, *logger);
+    }
+
+
+    /*
+     * Helper function to tune the socket of data connection. It must run before the socket connects or listens
+     */
+    void tuneDataSocket(int sockfd) {
+        socketOptions.applyToDataSocket(sockfd, *logger);
+    }
+
+
+    /*
+     * Helper function to get the local port the socket is bound to
+     */
+    uint16_t localPort(int sockfd) {
+        sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        if (getsockname(sockfd, reinterpret_cast<sockaddr *>(&addr), &len) == -1)
+            throw SocketException();
+
+        if (addr.ss_family == AF_INET6)
+            return ntohs(reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_port);
+
+        return ntohs(reinterpret_cast<sockaddr_in *>(&addr)->sin_port);
+    }
+
+
+    /*
+     * Helper function to connect to ftp server. Function return socket descriptor and protocol of the connection.
+     * Every address of the host takes part in the connect race, so an unreachable address does not hold up the others
      */
     void connectHost(const std::string &host, const std::string &port, int &sockfd, NetProtocol &protocol) {
-        // get ip address
-        int stat;
-        addrinfo hint, *ipAddrHdr = nullptr;
-        memset(&hint, 0, sizeof(hint));
-        hint.ai_family = AF_UNSPEC;
-        hint.ai_socktype = SOCK_STREAM;
-        if ((stat = getaddrinfo(host.c_str(), port.c_str(), &hint, &ipAddrHdr)) == -1)
+        std::vector<Address> addresses = resolveHost(host, port);
+        size_t winner;
+        connectRace(addresses, false, sockfd, winner);
+        protocol = addresses[winner].first.ss_family == AF_INET ? IPv4 : IPv6;
+    }
+
+
+    /*
+     * Helper function to race connects to the addresses, a new attempt every connectAttemptDelay, all within the
+     * connect timeout. The winning socket is returned in blocking mode with the index of its address. Sockets of
+     * data connection are tuned before they connect
+     */
+    void connectRace(const std::vector<Address> &addresses, bool dataChannel, int &sockfd, size_t &winner) {
+        ConnectRace::SocketSetup setup;
+        if (dataChannel)
+            setup = [this](int fd) { tuneDataSocket(fd); };
+
+        ConnectRace race(addresses, connectAttemptDelay, setup);
+        sockfd = race.run(timeouts.connect, winner);
+        int flags = fcntl(sockfd, F_GETFL);
+        fcntl(sockfd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+
+
+    /*
+     * Helper function to get the addresses of the passive data connection in the order they are tried. It is the
+     * cached address of the control connection with the port replaced. If the address advertised in PASV reply is
+     * preferred, it comes first and the control connection address is the fallback
+     */
+    void passiveAddresses(const std::string &advertisedIpAddr, uint16_t port, std::vector<Address> &addresses) {
+        Address address;
+        if (useAdvertisedAddr && !advertisedIpAddr.empty()) {
+            sockaddr_in advertised;
+            memset(&advertised, 0, sizeof(advertised));
+            advertised.sin_family = AF_INET;
+            advertised.sin_port   = htons(port);
+            if (inet_pton(AF_INET, advertisedIpAddr.c_str(), &advertised.sin_addr) == 1) {
+                memset(&address.first, 0, sizeof(address.first));
+                memcpy(&address.first, &advertised, sizeof(advertised));
+                address.second = sizeof(advertised);
+                addresses.push_back(address);
+            }
+        }
+
+        address = peer;
+        if (address.first.ss_family == AF_INET6)
+            reinterpret_cast<sockaddr_in6 *>(&address.first)->sin6_port = htons(port);
+        else
+            reinterpret_cast<sockaddr_in *>(&address.first)->sin_port = htons(port);
+
+        if (addresses.empty() || memcmp(&addresses.front().first, &address.first, address.second) != 0)
+            addresses.push_back(address);
+    }
+
+
+    /*
+     * Helper function to write ftp command to control connection. It will log the command after sending
+     */
+    void writeAndLogCtrlCmd(const std::string &cmd) {
+        writeSockEnsure(ctrlSockfd, reinterpret_cast<const Byte *>(cmd.c_str()), cmd.size());
+        logDateTime(*logger) << "Sent " << cmd;
+    }
+
+
+    /*
+     * Helper function to get data from socket and pass it to the sink chunk by chunk.
+     * Function returns the number of bytes that is read from the socket
+     */
+    size_t readDataReply(int sockfd, const DataSink &sink) {
+        std::vector<Byte> chunk(DATA_CHUNK_SIZE);
+        size_t readSofar = 0;
+
+        ssize_t rn;
+        while ((rn = readSockSome(sockfd, chunk.data(), chunk.size())) > 0) {
+            readSofar += static_cast<size_t>(rn);
+            if (!sink(chunk.data(), static_cast<size_t>(rn)))
+                break;
+        }
+
+        return readSofar;
+    }
+
+
+    /*
+     * Helper function to get deflated data from socket, inflate it and pass it to the sink chunk by chunk.
+     * The connection must not close in the middle of a deflate stream, since the data is then cut short.
+     * Function returns the number of bytes after inflating
+     */
+    size_t inflateDataReply(int sockfd, const DataSink &sink) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit(&stream) != Z_OK)
             throw SocketException();
 
-        // loop through all possible ip address to open socket
-        addrinfo *ipAddr;
-        for (ipAddr = ipAddrHdr; ipAddr; ipAddr = ipAddr->ai_next) {
-            int fd = socket(ipAddr->ai_family, ipAddr->ai_socktype, ipAddr->ai_protocol);
-            if (fd == -1)
+        std::unique_ptr<z_stream, int (*)(z_stream *)> streamGuard(&stream, inflateEnd);
+        std::vector<Byte> in(DATA_CHUNK_SIZE), out(DATA_CHUNK_SIZE);
+        size_t inflateSofar = 0;
+        bool streamPending = false;
+
+        ssize_t rn;
+        while ((rn = readSockSome(sockfd, in.data(), in.size())) > 0) {
+            stream.next_in  = in.data();
+            stream.avail_in = static_cast<uInt>(rn);
+            streamPending   = true;
+            do {
+                stream.next_out  = out.data();
+                stream.avail_out = static_cast<uInt>(out.size());
+                int stat = inflate(&stream, Z_NO_FLUSH);
+                if (stat == Z_STREAM_END) {
+                    inflateReset(&stream);
+                    streamPending = stream.avail_in > 0;
+                }
+                else if (stat != Z_OK && stat != Z_BUF_ERROR) {
+                    errno = EPROTO;
+                    throw SocketException();
+                }
+
+                size_t inflated = out.size() - stream.avail_out;
+                inflateSofar += inflated;
+                countFileBytes(inflated);
+                if (inflated > 0 && !sink(out.data(), inflated))
+                    return inflateSofar;
+            } while (stream.avail_in > 0 || stream.avail_out == 0);
+        }
+
+        if (streamPending) {
+            errno = EPROTO;
+            throw SocketException();
+        }
+
+        return inflateSofar;
+    }
+
+
+    /*
+     * Helper function to read the blocks of one file from socket and pass their data to the sink. The
+     * connection stays usable after the EOF block, so the rest of the file is drained even if the sink
+     * stops early. Function returns the number of bytes passed to the sink
+     */
+    size_t readBlockDataReply(int sockfd, const DataSink &sink) {
+        std::vector<Byte> chunk(BLOCK_SIZE_MAX);
+        size_t readSofar = 0;
+        bool sinkDone = false;
+
+        Byte descriptor = 0;
+        while (!(descriptor & BLOCK_DESCRIPTOR_EOF)) {
+            Byte header[BLOCK_HEADER_SIZE];
+            readSockEnsure(sockfd, header, BLOCK_HEADER_SIZE);
+            descriptor = header[0];
+            size_t count = static_cast<size_t>(header[1]) << 8 | header[2];
+            readSockEnsure(sockfd, chunk.data(), count);
+
+            // restart markers are not part of the file
+            if ((descriptor & BLOCK_DESCRIPTOR_MARK) || count == 0 || sinkDone)
                 continue;
 
-            if (connect(fd, ipAddr->ai_addr, ipAddr->ai_addrlen) == -1) {
-                closeSocket(fd);
+            readSofar += count;
+            countFileBytes(count);
+            sinkDone = !sink(chunk.data(), count);
+        }
+
+        return readSofar;
+    }
+
+
+    /*
+     * Helper function to read data from socket in the current transfer mode and pass it to the sink
+     */
+    size_t readModeDataReply(int sockfd, const DataSink &sink) {
+        if (transferMode == COMPRESSED_MODE)
+            return inflateDataReply(sockfd, sink);
+
+        if (transferMode == BLOCK_MODE)
+            return readBlockDataReply(sockfd, sink);
+
+        return readDataReply(sockfd, sink);
+    }
+
+
+    /*
+     * Helper function to make the sink that writes the data to the file descriptor. A failed write stops
+     * the transfer and keeps its errno in fileError
+     */
+    DataSink fileSink(int fd) {
+        return [this, fd](const Byte *buf, size_t size) {
+            if (writeFileEnsure(fd, buf, size))
+                return true;
+
+            fileError = errno;
+            return false;
+        };
+    }
+
+
+    /*
+     * Helper function to move data from socket to the file descriptor with splice through a pipe.
+     * If the file cannot be used with splice, it falls back to read the socket into a buffer. A failed
+     * write to the file stops the transfer and keeps its errno in fileError.
+     * Function returns the number of bytes that is read from the socket
+     */
+    size_t spliceDataReply(int sockfd, int fd) {
+        int pipefd[2];
+        if (pipe2(pipefd, O_CLOEXEC) == -1)
+            return readDataReply(sockfd, fileSink(fd));
+
+        FileDescriptor pipeRead(pipefd[0]), pipeWrite(pipefd[1]);
+        size_t readSofar = 0;
+        while (true) {
+            auto rn = splice(sockfd, nullptr, pipeWrite.get(), nullptr, DATA_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (rn == -1 && errno == EINTR)
                 continue;
+
+            if (rn == -1 && errno == EINVAL && readSofar == 0)
+                return readDataReply(sockfd, fileSink(fd));
+
+            if (rn == -1)
+                throwIoError("reading data connection");
+
+            if (rn == 0)
+                break;
+
+            checkTransferDeadline();
+            countTransferred(static_cast<size_t>(rn));
+
+            // drain the pipe into the file
+            auto remain = static_cast<size_t>(rn);
+            while (remain > 0) {
+                auto wn = splice(pipeRead.get(), nullptr, fd, nullptr, remain, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (wn == -1 && errno == EINTR)
+                    continue;
+
+                // the file system does not take splice, so the rest of the transfer goes through a buffer
+                if (wn == -1 && (errno == EINVAL || errno == ENOSYS) && readSofar == 0 && remain == static_cast<size_t>(rn))
+                    return drainPipe(pipeRead.get(), remain, fileSink(fd)) ? remain + readDataReply(sockfd, fileSink(fd)) : remain;
+
+                if (wn <= 0) {
+                    fileError = wn == 0 ? EIO : errno;
+                    return readSofar + static_cast<size_t>(rn);
+                }
+
+                remain -= static_cast<size_t>(wn);
             }
 
-            sockfd = fd;
-            protocol = ipAddr->ai_family == AF_INET ? IPv4 : IPv6;
+            readSofar += static_cast<size_t>(rn);
+        }
 
-            break;
+        return readSofar;
+    }
+
+
+    /*
+     * Helper function to read size bytes out of the pipe and pass them to the sink.
+     * Function returns false if the sink stops
+     */
+    static bool drainPipe(int pipefd, size_t size, const DataSink &sink) {
+        std::vector<Byte> buf(size);
+        size_t readSofar = 0;
+        while (readSofar < size) {
+            auto rn = read(pipefd, buf.data() + readSofar, size - readSofar);
+            if (rn == -1 && errno == EINTR)
+                continue;
+
+            if (rn <= 0)
+                throw SocketException();
+
+            readSofar += static_cast<size_t>(rn);
         }
 
-        if (ipAddr == nullptr) {
-            freeaddrinfo(ipAddrHdr);
+        return sink(buf.data(), size);
+    }
+
+
+    /*
+     * Helper function to pull data from the source chunk by chunk and write it to the socket.
+     * Function returns the number of bytes that is written to the socket
+     */
+    size_t sendDataConnect(int sockfd, const DataSource &source) {
+        std::vector<Byte> chunk(DATA_CHUNK_SIZE);
+        size_t writeSofar = 0;
+
+        size_t rn;
+        while ((rn = source(chunk.data(), chunk.size())) > 0) {
+            writeSockEnsure(sockfd, chunk.data(), rn);
+            writeSofar += rn;
+        }
+
+        return writeSofar;
+    }
+
+
+    /*
+     * Helper function to pull data from the source chunk by chunk, deflate it and write it to the socket.
+     * Function returns the number of bytes before deflating
+     */
+    size_t deflateDataConnect(int sockfd, const DataSource &source) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
             throw SocketException();
+
+        std::unique_ptr<z_stream, int (*)(z_stream *)> streamGuard(&stream, deflateEnd);
+        std::vector<Byte> in(DATA_CHUNK_SIZE), out(DATA_CHUNK_SIZE);
+        size_t deflateSofar = 0;
+
+        int flush = Z_NO_FLUSH;
+        while (flush != Z_FINISH) {
+            size_t rn = source(in.data(), in.size());
+            deflateSofar += rn;
+            countFileBytes(rn);
+            flush = rn == 0 ? Z_FINISH : Z_NO_FLUSH;
+            stream.next_in  = in.data();
+            stream.avail_in = static_cast<uInt>(rn);
+            do {
+                stream.next_out  = out.data();
+                stream.avail_out = static_cast<uInt>(out.size());
+                deflate(&stream, flush);
+                writeSockEnsure(sockfd, out.data(), out.size() - stream.avail_out);
+            } while (stream.avail_out == 0);
         }
 
-        freeaddrinfo(ipAddrHdr);
+        return deflateSofar;
     }
 
 
     /*
-     * Helper function to write ftp command to control connection. It will log the command after sending
+     * Helper function to pull data from the source and write it to the socket as blocks, ending with
+     * an empty EOF block. Function returns the number of bytes of data sent
      */
-    void writeAndLogCtrlCmd(const std::string &cmd) {
-        writeSockEnsure(ctrlSockfd, reinterpret_cast<const Byte *>(cmd.c_str()), cmd.size());
-        logDateTime(*logger) << "Sent " << cmd;
+    size_t sendBlockDataConnect(int sockfd, const DataSource &source) {
+        std::vector<Byte> block(BLOCK_HEADER_SIZE + BLOCK_SIZE_MAX);
+        size_t writeSofar = 0;
+
+        size_t rn;
+        do {
+            rn = source(block.data() + BLOCK_HEADER_SIZE, BLOCK_SIZE_MAX);
+            block[0] = rn == 0 ? BLOCK_DESCRIPTOR_EOF : 0;
+            block[1] = static_cast<Byte>(rn >> 8);
+            block[2] = static_cast<Byte>(rn);
+            writeSockEnsure(sockfd, block.data(), BLOCK_HEADER_SIZE + rn);
+            writeSofar += rn;
+            countFileBytes(rn);
+        } while (rn > 0);
+
+        return writeSofar;
     }
 
 
     /*
-     * Helper function to get data from socket and put it into vector container
+     * Helper function to pull data from the source and write it to the socket in the current transfer mode
      */
-    void readDataReply(int sockfd, std::vector<Byte> &buf) {
-        Byte rb[BUFFER_SIZE_MIN];
-        buf.reserve(BUFFER_SIZE_MIN);
+    size_t sendModeDataConnect(int sockfd, const DataSource &source) {
+        if (transferMode == COMPRESSED_MODE)
+            return deflateDataConnect(sockfd, source);
+
+        if (transferMode == BLOCK_MODE)
+            return sendBlockDataConnect(sockfd, source);
+
+        return sendDataConnect(sockfd, source);
+    }
+
+
+    /*
+     * Helper function to send length bytes of file starting from offset to the socket with sendfile.
+     * If the file cannot be used with sendfile, it falls back to read the file into a buffer
+     */
+    size_t sendFileEnsure(int sockfd, int fd, off_t offset, size_t length) {
+        // a limited rate is paced chunk by chunk instead of handing large pieces of the file to the kernel
+        size_t chunkMax = rateLimited() ? static_cast<size_t>(DATA_CHUNK_SIZE) : SENDFILE_CHUNK_MAX;
+        size_t writeSofar = 0;
+        while (writeSofar < length) {
+            auto wn = sendfile(sockfd, fd, &offset, std::min(chunkMax, length - writeSofar));
+            if (wn == -1 && errno == EINTR)
+                continue;
+
+            if (wn == -1 && (errno == EINVAL || errno == ENOSYS) && writeSofar == 0)
+                return sendFileBuffered(sockfd, fd, offset, length);
+
+            if (wn == -1)
+                throwIoError("writing data connection");
+
+            // file is shorter than expected
+            if (wn == 0)
+                break;
 
-        int rn;
-        while ((rn = readSockEnsure(sockfd, rb, BUFFER_SIZE_MIN)) > 0) {
-            std::copy(rb, rb + rn, std::back_inserter(buf));
+            writeSofar += static_cast<size_t>(wn);
+            checkTransferDeadline();
+            countTransferred(static_cast<size_t>(wn));
+        }
+
+        return writeSofar;
+    }
+
+
+    /*
+     * Helper function to send length bytes of file starting from offset to the socket through a buffer.
+     * A failed read of the file stops the transfer and keeps its errno in fileError
+     */
+    size_t sendFileBuffered(int sockfd, int fd, off_t offset, size_t length) {
+        size_t remain = length;
+        return sendModeDataConnect(sockfd, [this, fd, &offset, &remain](Byte *buf, size_t size) -> size_t {
+            ssize_t rn;
+            do {
+                rn = pread(fd, buf, std::min(size, remain), offset);
+            } while (rn == -1 && errno == EINTR);
+
+            // the transfer is cut off before its end in compressed or block mode, so the server cannot take it as complete
+            if (rn == -1) {
+                fileError = errno;
+                throw SocketException();
+            }
+
+            offset += rn;
+            remain -= static_cast<size_t>(rn);
+            return static_cast<size_t>(rn);
+        });
+    }
+
+
+    /*
+     * Helper function to run the transfer on the data socket. In active mode, it accepts the connection
+     * from the server first and closes it after the transfer. In block mode, the accepted connection
+     * replaces the listening socket and is kept for the next transfers. The transfer runs under the
+     * idle and transfer timeouts, is paced by the rate limits and reports its progress
+     */
+    template<typename Transfer>
+    size_t transferDataConnect(Transfer transfer) {
+        auto timedTransfer = [this, &transfer](int sockfd) {
+            startTransferTimer(sockfd);
+            transferLimit.refill();
+            progress.start(expectedSize);
+            expectedSize = 0;
+            transferring = true;
+            std::unique_ptr<Impl, void (*)(Impl *)> timerGuard(this, [](Impl *impl) {
+                impl->transferDeadline = std::chrono::steady_clock::time_point();
+                impl->transferring = false;
+            });
+
+            // a failed transfer is reported done as well, so whatever draws the progress ends its line
+            size_t transferred;
+            try {
+                transferred = transfer(sockfd);
+            } catch (...) {
+                progress.finish(0);
+                throw;
+            }
+
+            progress.finish(transferred);
+            return transferred;
+        };
+
+        if (transferMode == BLOCK_MODE) {
+            if (activeDataMode) {
+                int sockfd;
+                acceptHost(dataSockfd, sockfd);
+                if (!isKeptListener(dataSockfd))
+                    closeSocket(dataSockfd);
+                dataSockfd = sockfd;
+                activeDataMode = false;
+            }
+
+            // a failed transfer leaves the blocks out of sync, so the connection cannot be reused
+            try {
+                return timedTransfer(dataSockfd);
+            } catch (...) {
+                close(dataSockfd);
+                dataSockfd = -1;
+                throw;
+            }
         }
+
+        if (!activeDataMode)
+            return timedTransfer(dataSockfd);
+
+        int sockfd;
+        size_t transferred;
+        acceptHost(dataSockfd, sockfd);
+        try {
+            transferred = timedTransfer(sockfd);
+        } catch (...) {
+            close(sockfd);
+            throw;
+        }
+        closeSocket(sockfd);
+
+        return transferred;
     }
 
 
@@ -155,52 +741,168 @@ struct FtpService::Impl {
         while (writeSofar < size) {
             auto wn = send(sockfd, buf + writeSofar, size - writeSofar, MSG_NOSIGNAL);
             if (wn < 0)
-                throw SocketException();
+                throwIoError("writing socket");
 
             writeSofar += static_cast<size_t>(wn);
+            countTransferred(static_cast<size_t>(wn));
         }
+
+        checkTransferDeadline();
+    }
+
+
+    /*
+     * Helper function to read a complete control reply from socket. The control connection is read
+     * through the framer buffer, so one read syscall can bring in several lines or replies
+     */
+    void readReplySockEnsure(int sockfd, FtpCtrlReply &reply) {
+        while (!ctrlFramer.next()) {
+            size_t available;
+            char *buf = ctrlFramer.prepare(BUFFER_SIZE_MIN, available);
+            auto rn = readSockSome(sockfd, reinterpret_cast<Byte *>(buf), available);
+            if (rn == 0) {
+                // connection closed, return the partial reply if any
+                ctrlFramer.takeRemaining(reply.msg);
+                parseCtrlReplyCode(reply.msg, reply.code);
+                reply.replyClass = FtpReplyFramer::replyClassOf(reply.code);
+                return;
+            }
+
+            ctrlFramer.commit(static_cast<size_t>(rn));
+        }
+
+        FtpReplyLine text = ctrlFramer.text();
+        reply.msg.assign(text.data, text.size);
+        reply.code       = static_cast<FtpCode>(ctrlFramer.code());
+        reply.replyClass = ctrlFramer.replyClass();
+    }
+
+
+    /*
+     * Helper function to read exactly size bytes from the socket. It is an error if the peer closes
+     * the connection before that
+     */
+    void readSockEnsure(int sockfd, Byte *buf, size_t size) {
+        size_t readSofar = 0;
+        while (readSofar < size) {
+            auto rn = readSockSome(sockfd, buf + readSofar, size - readSofar);
+            if (rn == 0) {
+                errno = ECONNRESET;
+                throw SocketException();
+            }
+
+            readSofar += static_cast<size_t>(rn);
+        }
+    }
+
+
+    /*
+     * Helper function to read whatever data is available on the socket, upto a certain size.
+     * Function returns 0 when the peer closes the connection
+     */
+    ssize_t readSockSome(int sockfd, Byte *buf, size_t size) {
+        ssize_t rn;
+        do {
+            rn = read(sockfd, buf, size);
+        } while (rn == -1 && errno == EINTR);
+
+        if (rn == -1)
+            throwIoError("reading socket");
+
+        checkTransferDeadline();
+        countTransferred(static_cast<size_t>(rn));
+        return rn;
+    }
+
+
+    /*
+     * Helper function to check if the data transfers are rate limited
+     */
+    bool rateLimited() const {
+        return transferLimit.rate() != 0 || (sharedLimit && sharedLimit->rate() != 0);
+    }
+
+
+    /*
+     * Helper function to count the bytes moved through data connection. They are taken out of the per
+     * transfer and shared rate limits, which sleeps when a limit is exceeded. In stream mode they are the
+     * bytes of the file, so they are added to the progress as well. Control connection traffic is not counted
+     */
+    void countTransferred(size_t bytes) {
+        if (!transferring || bytes == 0)
+            return;
+
+        transferLimit.consume(bytes);
+        if (sharedLimit)
+            sharedLimit->consume(bytes);
+
+        if (transferMode == STREAM_MODE)
+            progress.add(bytes);
     }
 
 
     /*
-     * Helper function to read line from socket
+     * Helper function to add the bytes of the file to the progress in compressed and block mode, where
+     * the data connection carries deflated data or block headers, so the progress matches the file size
      */
-    void readLineSockEnsure(int sockfd, std::string &line) {
-        char ch;
-        ssize_t rn;
-        line = "";
-        do {
-            rn = read(sockfd, &ch, 1);
-            if (rn == -1)
-                throw SocketException();
+    void countFileBytes(size_t bytes) {
+        if (transferring && bytes > 0 && transferMode != STREAM_MODE)
+            progress.add(bytes);
+    }
 
-            if (rn == 0)
-                break;
 
-            line += ch;
-        } while (ch != '\n');
+    /*
+     * Helper function to throw the exception of the failed read or write. The socket timeout of SO_RCVTIMEO
+     * and SO_SNDTIMEO fails the call with EAGAIN, and TCP_USER_TIMEOUT with ETIMEDOUT
+     */
+    [[noreturn]] void throwIoError(const char *operation) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT)
+            throw TimeoutException(operation);
+
+        throw SocketException();
     }
 
 
     /*
-     * Helper function to read data to the raw buffer upto a certain size. Function returns
-     * the number of bytes that is read into buffer and is guaranteed to be equal or smaller than
-     * the max size.
+     * Helper function to throw TimeoutException once the transfer in progress runs past its deadline.
+     * The deadline is checked between chunks, and the idle timeout bounds the wait for each chunk
      */
-    int readSockEnsure(int sockfd, Byte *buf, int size) {
-        int readSoFar = 0;
-        while (readSoFar < size) {
-            auto rn = read(sockfd, buf + readSoFar, static_cast<unsigned long>(size - readSoFar));
-            if (rn == -1)
-                throw SocketException();
+    void checkTransferDeadline() {
+        if (transferDeadline != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() > transferDeadline)
+            throw TimeoutException("transferring data");
+    }
 
-            if (rn == 0)
-                break;
 
-            readSoFar += rn;
+    /*
+     * Helper function to start the deadline of the transfer on the data socket. A read or write waits at most
+     * the idle timeout, or the transfer timeout if it is shorter
+     */
+    void startTransferTimer(int sockfd) {
+        auto timeout = timeouts.idle;
+        if (timeouts.transfer.count() > 0) {
+            transferDeadline = std::chrono::steady_clock::now() + timeouts.transfer;
+            if (timeout.count() == 0 || timeouts.transfer < timeout)
+                timeout = timeouts.transfer;
         }
 
-        return readSoFar;
+        setSocketTimeout(sockfd, timeout);
+    }
+
+
+    /*
+     * Helper function to limit how long a read or write on the socket may wait without progress. Timeout 0
+     * waits forever
+     */
+    void setSocketTimeout(int sockfd, std::chrono::milliseconds timeout) {
+        timeval tv;
+        tv.tv_sec  = static_cast<time_t>(timeout.count() / 1000);
+        tv.tv_usec = static_cast<suseconds_t>(timeout.count() % 1000 * 1000);
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        // data sent but never acknowledged fails the connection as well
+        unsigned int userTimeout = static_cast<unsigned int>(timeout.count());
+        setsockopt(sockfd, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout, sizeof(userTimeout));
     }
 
 
@@ -253,11 +955,32 @@ struct FtpService::Impl {
 
 
     int ctrlSockfd;
+    FtpReplyFramer ctrlFramer;
     int dataSockfd;
     bool activeDataMode;
+    bool keepListener;
+    std::vector<int> keptListenSockfds;
+    size_t nextKeptListener;
+    bool useAdvertisedAddr;
+    SocketOptions socketOptions;
+    FtpTimeouts timeouts;
+    std::chrono::steady_clock::time_point transferDeadline;
+    TokenBucket transferLimit;
+    std::shared_ptr<TokenBucket> sharedLimit;
+    ProgressMeter progress;
+    uint64_t expectedSize;
+    bool transferring;
+    uint16_t activePortMin;
+    uint16_t activePortMax;
+    std::chrono::milliseconds connectAttemptDelay;
+    Address peer;
     NetProtocol netProtocol;
+    TransferMode transferMode;
+    char transferType;
     std::string hostname;
     std::string localIpAddr;
+    std::unique_ptr<IoUringEngine> uring;
+    int fileError;
     std::ostream *logger;
 };
 
@@ -267,7 +990,21 @@ FtpService::FtpService(std::ostream *logger) {
     _impl->ctrlSockfd = -1;
     _impl->dataSockfd = -1;
     _impl->activeDataMode = true;
+    _impl->keepListener = false;
+    _impl->nextKeptListener = 0;
+    _impl->useAdvertisedAddr = false;
+    _impl->socketOptions = SocketOptions::lan();
+    _impl->timeouts = DEFAULT_TIMEOUTS;
+    _impl->expectedSize = 0;
+    _impl->transferring = false;
+    _impl->fileError = 0;
+    _impl->activePortMin = 0;
+    _impl->activePortMax = 0;
+    _impl->connectAttemptDelay = CONNECT_ATTEMPT_DELAY;
+    _impl->peer.second = 0;
     _impl->netProtocol = UNSPECIFIED;
+    _impl->transferMode = STREAM_MODE;
+    _impl->transferType = DEFAULT_TRANSFER_TYPE;
     _impl->hostname = "";
     _impl->localIpAddr = "";
     _impl->logger = logger;
@@ -277,8 +1014,10 @@ FtpService::FtpService(std::ostream *logger) {
 FtpService::~FtpService() {
     if (_impl->ctrlSockfd != -1)
         close(_impl->ctrlSockfd);
-    if (_impl->dataSockfd != -1)
+    if (_impl->dataSockfd != -1 && !_impl->isKeptListener(_impl->dataSockfd))
         close(_impl->dataSockfd);
+    for (int listenSockfd : _impl->keptListenSockfds)
+        close(listenSockfd);
 }
 
 
@@ -287,24 +1026,195 @@ NetProtocol FtpService::netProtocol() const {
 }
 
 
+bool FtpService::setIoUringEnabled(bool enabled) {
+    if (!enabled) {
+        _impl->uring.reset();
+        return true;
+    }
+
+    if (_impl->uring)
+        return true;
+
+    if (!IoUringEngine::available()) {
+        logDateTime(*_impl->logger) << "io_uring is not supported by the system. Use blocking data transfer" << std::endl;
+        return false;
+    }
+
+    try {
+        _impl->uring = std::make_unique<IoUringEngine>();
+    } catch (const SocketException &e) {
+        logDateTime(*_impl->logger) << "Cannot set up io_uring: " << e.what() << ". Use blocking data transfer" << std::endl;
+        return false;
+    }
+
+    logDateTime(*_impl->logger) << "Use io_uring for data transfer" << std::endl;
+    return true;
+}
+
+
+bool FtpService::ioUringEnabled() const {
+    return _impl->uring != nullptr;
+}
+
+
+void FtpService::setTransferMode(TransferMode mode) {
+    // only block mode keeps the data connection between transfers
+    if (_impl->transferMode == BLOCK_MODE && mode != BLOCK_MODE)
+        shutdownDataConnect();
+
+    _impl->transferMode = mode;
+}
+
+
+TransferMode FtpService::transferMode() const {
+    return _impl->transferMode;
+}
+
+
+void FtpService::setTransferType(char type) {
+    _impl->transferType = type;
+}
+
+
+char FtpService::transferType() const {
+    return _impl->transferType;
+}
+
+
+void FtpService::setUseAdvertisedAddress(bool use) {
+    _impl->useAdvertisedAddr = use;
+}
+
+
+bool FtpService::useAdvertisedAddress() const {
+    return _impl->useAdvertisedAddr;
+}
+
+
+void FtpService::setActivePortRange(uint16_t portMin, uint16_t portMax) {
+    _impl->activePortMin = portMin;
+    _impl->activePortMax = portMax;
+
+    // the kept listening socket may be bound outside the new range
+    _impl->closeKeptListeners();
+}
+
+
+void FtpService::activePortRange(uint16_t &portMin, uint16_t &portMax) const {
+    portMin = _impl->activePortMin;
+    portMax = _impl->activePortMax;
+}
+
+
+void FtpService::setSocketOptions(const SocketOptions &options) {
+    _impl->socketOptions = options;
+
+    // the data sockets opened from now on are tuned when they are created
+    if (_impl->ctrlSockfd != -1)
+        _impl->tuneCtrlSocket(_impl->ctrlSockfd);
+
+    logDateTime(*_impl->logger) << "Use socket options profile " << options.profile << std::endl;
+}
+
+
+const SocketOptions &FtpService::socketOptions() const {
+    return _impl->socketOptions;
+}
+
+
+void FtpService::setTimeouts(const FtpTimeouts &timeouts) {
+    _impl->timeouts = timeouts;
+    for (auto timeout : {&_impl->timeouts.connect, &_impl->timeouts.accept, &_impl->timeouts.idle, &_impl->timeouts.transfer})
+        *timeout = std::min(*timeout, TIMEOUT_MAX);
+
+    if (_impl->ctrlSockfd != -1)
+        _impl->setSocketTimeout(_impl->ctrlSockfd, _impl->timeouts.idle);
+}
+
+
+const FtpTimeouts &FtpService::timeouts() const {
+    return _impl->timeouts;
+}
+
+
+void FtpService::setTransferRateLimit(uint64_t rate, uint64_t burst) {
+    _impl->transferLimit.setRate(rate, burst);
+}
+
+
+const TokenBucket &FtpService::transferRateLimit() const {
+    return _impl->transferLimit;
+}
+
+
+void FtpService::setSharedRateLimit(std::shared_ptr<TokenBucket> limit) {
+    _impl->sharedLimit = std::move(limit);
+}
+
+
+const std::shared_ptr<TokenBucket> &FtpService::sharedRateLimit() const {
+    return _impl->sharedLimit;
+}
+
+
+void FtpService::setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval) {
+    _impl->progress.setCallback(std::move(callback), interval);
+}
+
+
+void FtpService::setExpectedTransferSize(uint64_t size) {
+    _impl->expectedSize = size;
+}
+
+
+void FtpService::setKeepListener(bool keep) {
+    _impl->keepListener = keep;
+    if (!keep)
+        _impl->closeKeptListeners();
+}
+
+
+bool FtpService::keepListener() const {
+    return _impl->keepListener;
+}
+
+
+void FtpService::setConnectAttemptDelay(std::chrono::milliseconds delay) {
+    _impl->connectAttemptDelay = delay;
+}
+
+
+std::chrono::milliseconds FtpService::connectAttemptDelay() const {
+    return _impl->connectAttemptDelay;
+}
+
+
 void FtpService::openCtrlConnect(const std::string &hostname, uint16_t port) {
     int sockfd;
     NetProtocol protocol;
     _impl->connectHost(hostname, std::to_string(port), sockfd, protocol);
+    _impl->tuneCtrlSocket(sockfd);
+    _impl->setSocketTimeout(sockfd, _impl->timeouts.idle);
 
     _impl->ctrlSockfd    = sockfd;
+    _impl->ctrlFramer.reset();
     _impl->hostname      = hostname;
     _impl->netProtocol   = protocol;
+    _impl->transferMode  = STREAM_MODE;
+    _impl->transferType  = DEFAULT_TRANSFER_TYPE;
     _impl->getIpAddress(protocol, sockfd, _impl->localIpAddr);
 
+    // data connections go to the same address, without resolving the host name again
+    _impl->peer.second = sizeof(_impl->peer.first);
+    getpeername(sockfd, reinterpret_cast<sockaddr *>(&_impl->peer.first), &_impl->peer.second);
+
     // log open connection
     logDateTime(*_impl->logger) << "Opened control connection with host " << _impl->hostname << " port " << port << std::endl;
 }
 
 
 void FtpService::readCtrlReply(FtpCtrlReply &reply) {
-    _impl->readLineSockEnsure(_impl->ctrlSockfd, reply.msg);
-    _impl->parseCtrlReplyCode(reply.msg, reply.code);
+    _impl->readReplySockEnsure(_impl->ctrlSockfd, reply);
 
     // log ctrl reply from server
     logDateTime(*_impl->logger) << "Received " << reply.msg << std::flush;
@@ -315,8 +1225,11 @@ void FtpService::closeCtrlConnect() {
     if (_impl->ctrlSockfd == -1)
         return;
 
+    shutdownDataConnect();
+    _impl->closeKeptListeners();
     _impl->closeSocket(_impl->ctrlSockfd);
     _impl->ctrlSockfd  = -1;
+    _impl->ctrlFramer.reset();
     _impl->netProtocol = UNSPECIFIED;
     _impl->localIpAddr = "";
 
@@ -326,60 +1239,217 @@ void FtpService::closeCtrlConnect() {
 
 
 void FtpService::openDataConnect(uint16_t port, bool active) {
-    int dataSockfd;
-    NetProtocol protocol;
+    // server drops the block mode data connection on PASV or PORT
+    shutdownDataConnect();
+
     if (!active) {
-        _impl->connectHost(_impl->hostname, std::to_string(port), dataSockfd, protocol);
+        openPassiveDataConnect("", port);
+        return;
+    }
+
+    int dataSockfd;
+    _impl->listenHost(std::to_string(port), dataSockfd);
+
+    // log open active data connection
+    logDateTime(*_impl->logger) << "Opened active data connection with host " << _impl->hostname << " port " << port << std::endl;
+
+    _impl->dataSockfd = dataSockfd;
+    _impl->activeDataMode = true;
+}
+
 
-        // log open passive data connection
-        logDateTime(*_impl->logger) << "Opened passive data connection with host " << _impl->hostname << " port " << port << std::endl;
+void FtpService::openActiveDataConnect(uint16_t &port) {
+    // server drops the block mode data connection on PASV or PORT
+    shutdownDataConnect();
+
+    // the kept listening sockets take turns to accept the data connection of every transfer, so the same
+    // connection is not opened again while the last one is in TIME_WAIT
+    if (!_impl->keptListenSockfds.empty() && _impl->keptListenSockfds.size() >= _impl->keptListenersMax()) {
+        _impl->useKeptListener(port);
+        return;
     }
+
+    int dataSockfd = -1;
+    if (_impl->activePortMin == 0)
+        _impl->listenHost("0", dataSockfd);
     else {
-        _impl->listenHost(std::to_string(port), dataSockfd);
+        // ports in use are skipped locally, without asking the server
+        for (uint32_t p = _impl->activePortMin; p <= _impl->activePortMax && dataSockfd == -1; ++p) {
+            try {
+                _impl->listenHost(std::to_string(p), dataSockfd);
+            } catch (const SocketException &) {
+                if (p == _impl->activePortMax && _impl->keptListenSockfds.empty())
+                    throw;
+            }
+        }
+
+        // the ports left free in the range are taken by other programs, so the kept listening sockets take turns
+        if (dataSockfd == -1) {
+            _impl->useKeptListener(port);
+            return;
+        }
+    }
 
-        // log open active data connection
-        logDateTime(*_impl->logger) << "Opened active data connection with host " << _impl->hostname << " port " << port << std::endl;
+    try {
+        port = _impl->localPort(dataSockfd);
+    } catch (const SocketException &) {
+        close(dataSockfd);
+        throw;
     }
 
+    // log open active data connection
+    logDateTime(*_impl->logger) << "Opened active data connection with host " << _impl->hostname << " port " << port << std::endl;
+
+    _impl->dataSockfd = dataSockfd;
+    _impl->activeDataMode = true;
+    if (_impl->keepListener)
+        _impl->keptListenSockfds.push_back(dataSockfd);
+}
+
+
+void FtpService::openPassiveDataConnect(const std::string &advertisedIpAddr, uint16_t port) {
+    // server drops the block mode data connection on PASV or PORT
+    shutdownDataConnect();
+
+    std::vector<Impl::Address> addresses;
+    _impl->passiveAddresses(advertisedIpAddr, port, addresses);
+
+    int dataSockfd;
+    size_t winner;
+    _impl->connectRace(addresses, true, dataSockfd, winner);
+
+    // log open passive data connection
+    const sockaddr_storage &addr = addresses[winner].first;
+    char ipAddr[INET6_ADDRSTRLEN] = "";
+    if (addr.ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6 *>(&addr)->sin6_addr, ipAddr, sizeof(ipAddr));
+    else
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in *>(&addr)->sin_addr, ipAddr, sizeof(ipAddr));
+    logDateTime(*_impl->logger) << "Opened passive data connection with host " << _impl->hostname << " (" << ipAddr << ") port " << port << std::endl;
+
     _impl->dataSockfd = dataSockfd;
-    _impl->activeDataMode = active;
+    _impl->activeDataMode = false;
 }
 
 
 void FtpService::sendDataConnect(const std::vector<Byte> &buf) {
-    if (_impl->activeDataMode) {
-        int sockfd;
-        _impl->acceptHost(_impl->dataSockfd, sockfd);
-        _impl->writeSockEnsure(sockfd, buf.data(), buf.size());
-        _impl->closeSocket(sockfd);
+    size_t offset = 0;
+    sendDataConnect([&buf, &offset](Byte *chunk, size_t size) {
+        size_t n = std::min(size, buf.size() - offset);
+        std::copy(buf.begin() + static_cast<std::ptrdiff_t>(offset), buf.begin() + static_cast<std::ptrdiff_t>(offset + n), chunk);
+        offset += n;
+        return n;
+    });
+}
+
+
+void FtpService::sendDataConnect(const DataSource &source) {
+    size_t sent = _impl->transferDataConnect([this, &source](int sockfd) {
+        return _impl->sendModeDataConnect(sockfd, source);
+    });
+
+    // log data sent through data connection
+    logDateTime(*_impl->logger) << "Sent " << sent << " bytes to host " << _impl->hostname << " through data connection" << std::endl;
+}
+
+
+bool FtpService::sendDataConnect(int fd, off_t offset, size_t length) {
+    _impl->fileError = 0;
+    size_t sent;
+    try {
+        sent = _impl->transferDataConnect([this, fd, offset, length](int sockfd) {
+            // the kernel cannot deflate or frame blocks, so other modes always go through a buffer
+            if (_impl->transferMode != STREAM_MODE)
+                return _impl->sendFileBuffered(sockfd, fd, offset, length);
+
+            if (_impl->uring && !_impl->rateLimited())
+                return _impl->uring->sendFromFile(sockfd, fd, offset, length);
+
+            return _impl->sendFileEnsure(sockfd, fd, offset, length);
+        });
+    } catch (const SocketException &) {
+        // the local file failed, not the connection
+        if (_impl->fileError == 0)
+            throw;
+
+        logDateTime(*_impl->logger) << "Failed to read the data from local file: " << strerror(_impl->fileError) << std::endl;
+        errno = _impl->fileError;
+        return false;
     }
-    else
-        _impl->writeSockEnsure(_impl->dataSockfd, buf.data(), buf.size());
 
     // log data sent through data connection
-    logDateTime(*_impl->logger) << "Sent " << buf.size() << " bytes to host " << _impl->hostname << " through data connection" << std::endl;
+    logDateTime(*_impl->logger) << "Sent " << sent << " bytes to host " << _impl->hostname << " through data connection" << std::endl;
+    return true;
 }
 
 
 void FtpService::readDataReply(std::vector<Byte> &buf) {
-    if (_impl->activeDataMode) {
-        int sockfd;
-        _impl->acceptHost(_impl->dataSockfd, sockfd);
-        _impl->readDataReply(sockfd, buf);
-        _impl->closeSocket(sockfd);
-    }
-    else
-        _impl->readDataReply(_impl->dataSockfd, buf);
+    buf.reserve(BUFFER_SIZE_MIN);
+    readDataReply([&buf](const Byte *chunk, size_t size) {
+        buf.insert(buf.end(), chunk, chunk + size);
+        return true;
+    });
+}
+
+
+void FtpService::readDataReply(const DataSink &sink) {
+    size_t received = _impl->transferDataConnect([this, &sink](int sockfd) {
+        return _impl->readModeDataReply(sockfd, sink);
+    });
+
+    // log data received through data connection
+    logDateTime(*_impl->logger) << "Received " << received << " bytes from host " << _impl->hostname << " through data connection" << std::endl;
+}
+
+
+bool FtpService::readDataReply(int fd) {
+    _impl->fileError = 0;
+    size_t received = _impl->transferDataConnect([this, fd](int sockfd) {
+        if (_impl->transferMode != STREAM_MODE)
+            return _impl->readModeDataReply(sockfd, _impl->fileSink(fd));
+
+        // io_uring writes at explicit offsets, so it needs a seekable file
+        if (_impl->uring && !_impl->rateLimited() && lseek(fd, 0, SEEK_CUR) != -1)
+            return _impl->uring->receiveToFile(sockfd, fd, _impl->fileError);
+
+        return _impl->spliceDataReply(sockfd, fd);
+    });
 
     // log data received through data connection
-    logDateTime(*_impl->logger) << "Received " << buf.size() << " bytes from host " << _impl->hostname << " through data connection" << std::endl;
+    logDateTime(*_impl->logger) << "Received " << received << " bytes from host " << _impl->hostname << " through data connection" << std::endl;
+    if (_impl->fileError == 0)
+        return true;
+
+    logDateTime(*_impl->logger) << "Failed to write the data to local file: " << strerror(_impl->fileError) << std::endl;
+    errno = _impl->fileError;
+    return false;
+}
+
+
+bool FtpService::dataConnectOpen() const {
+    return _impl->transferMode == BLOCK_MODE && _impl->dataSockfd != -1 && !_impl->activeDataMode;
 }
 
 
 void FtpService::closeDataConnect() {
+    if (_impl->dataSockfd == -1 || dataConnectOpen())
+        return;
+
+    shutdownDataConnect();
+}
+
+
+void FtpService::shutdownDataConnect() {
     if (_impl->dataSockfd == -1)
         return;
 
+    // the kept listening socket stays open for a later transfer
+    if (_impl->isKeptListener(_impl->dataSockfd)) {
+        _impl->dataSockfd     = -1;
+        _impl->activeDataMode = false;
+        return;
+    }
+
     _impl->closeSocket(_impl->dataSockfd);
     _impl->dataSockfd     = -1;
     _impl->activeDataMode = false;
@@ -413,6 +1483,24 @@ void FtpService::sendPWD() {
 }
 
 
+void FtpService::sendFEAT() {
+    std::string cmd = "FEAT\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
+void FtpService::sendMODE(TransferMode mode) {
+    std::string cmd = std::string("MODE ") + static_cast<char>(mode) + "\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
+void FtpService::sendNOOP() {
+    std::string cmd = "NOOP\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
 void FtpService::sendQUIT() {
     std::string cmd = "QUIT\r\n";
     _impl->writeAndLogCtrlCmd(cmd);
@@ -426,6 +1514,13 @@ void FtpService::sendLIST(const std::string &path) {
 }
 
 
+void FtpService::sendNLST(const std::string &path) {
+    std::string space = path.empty() ? "" : " ";
+    std::string cmd = "NLST" + space + path + "\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
 void FtpService::sendPASV() {
     std::string cmd = "PASV\r\n";
     _impl->writeAndLogCtrlCmd(cmd);
@@ -490,6 +1585,111 @@ void FtpService::sendSTOR(const std::string &filePath) {
 }
 
 
+void FtpService::sendAPPE(const std::string &filePath) {
+    std::string cmd = "APPE " + filePath + "\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
+void FtpService::sendTYPE(char type) {
+    std::string cmd = std::string("TYPE ") + type + "\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
+void FtpService::sendREST(uint64_t offset) {
+    std::string cmd = "REST " + std::to_string(offset) + "\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
+/*
+ * Helper function to build SIZE command without the line ending
+ */
+static std::string buildSIZE(const std::string &filePath) {
+    return "SIZE " + filePath;
+}
+
+
+void FtpService::sendSIZE(const std::string &filePath) {
+    std::string cmd = buildSIZE(filePath) + "\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
+void FtpService::sendMDTM(const std::string &filePath) {
+    std::string cmd = "MDTM " + filePath + "\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
+void FtpService::sendDELE(const std::string &filePath) {
+    std::string cmd = "DELE " + filePath + "\r\n";
+    _impl->writeAndLogCtrlCmd(cmd);
+}
+
+
+void FtpService::sendPipelined(const std::vector<std::string> &cmds, std::vector<FtpCtrlReply> &replies) {
+    replies.resize(cmds.size());
+
+    std::string batch;
+    size_t sent = 0, received = 0;
+    auto sendBatch = [&]() {
+        // keep the window full so the server never waits for the next command
+        size_t count = std::min(PIPELINE_WINDOW - (sent - received), cmds.size() - sent);
+        batch.clear();
+        for (size_t i = sent; i < sent + count; ++i)
+            batch += cmds[i] + "\r\n";
+
+        _impl->writeSockEnsure(_impl->ctrlSockfd, reinterpret_cast<const Byte *>(batch.c_str()), batch.size());
+        for (size_t i = sent; i < sent + count; ++i)
+            logDateTime(*_impl->logger) << "Sent " << cmds[i] << "\r\n";
+
+        sent += count;
+    };
+
+    if (!cmds.empty())
+        sendBatch();
+
+    while (received < cmds.size()) {
+        FtpCtrlReply &reply = replies[received];
+        _impl->readReplySockEnsure(_impl->ctrlSockfd, reply);
+        logDateTime(*_impl->logger) << "Received " << reply.msg << std::flush;
+
+        if (reply.msg.empty()) {
+            errno = ECONNRESET;
+            throw SocketException();
+        }
+
+        // preliminary reply is followed by the final reply of the same command
+        if (reply.replyClass == POSITIVE_PRELIMINARY)
+            continue;
+
+        ++received;
+
+        // server closes the connection, the commands after this one are never answered
+        if (reply.code == SERVICE_UNAVAILABLE) {
+            replies.resize(received);
+            return;
+        }
+
+        // refill the window once half of it is answered
+        if (sent < cmds.size() && sent - received <= PIPELINE_WINDOW / 2)
+            sendBatch();
+    }
+}
+
+
+void FtpService::sendPipelinedSIZE(const std::vector<std::string> &filePaths, std::vector<FtpCtrlReply> &replies) {
+    std::vector<std::string> cmds;
+    cmds.reserve(filePaths.size());
+    for (const auto &filePath : filePaths)
+        cmds.push_back(buildSIZE(filePath));
+
+    sendPipelined(cmds, replies);
+}
+
+
 void FtpService::parsePASVReply(const std::string &pasvReply, std::string &ipAddr, uint16_t &port) {
     std::string ipAddrPort;
     bool beginParse = false;
@@ -541,3 +1741,28 @@ SocketException::~SocketException() {}
 
 const char *SocketException::what() const noexcept { return strerror(errno); }
 
+
+TimeoutException::TimeoutException(const std::string &operation)
+    : _msg{"Timed out " + operation}
+{}
+
+
+TimeoutException::~TimeoutException() {}
+
+
+const char *TimeoutException::what() const noexcept { return _msg.c_str(); }
+
+
+ResolveException::ResolveException(int status)
+    : _status{status}, _msg{status == EAI_SYSTEM ? strerror(errno) : gai_strerror(status)}
+{}
+
+
+ResolveException::~ResolveException() {}
+
+
+const char *ResolveException::what() const noexcept { return _msg.c_str(); }
+
+
+int ResolveException::status() const { return _status; }
+
@@ -7,12 +7,32 @@
 #include <functional>
 #include <vector>
 #include <limits>
+#include <chrono>
 #include <exception>
+#include <sys/types.h>
+#include "SocketOptions.h"
+#include "TokenBucket.h"
+#include "TransferProgress.h"
 
 
 using Byte = unsigned char;
 
 
+/*
+ * DataSink
+ * Consume a chunk of bytes received through data connection. Return false to stop the transfer early
+ */
+using DataSink = std::function<bool(const Byte *buf, size_t size)>;
+
+
+/*
+ * DataSource
+ * Fill the buffer with upto size bytes to be sent through data connection. Return the number of
+ * bytes written into the buffer, or 0 when there is no more data
+ */
+using DataSource = std::function<size_t(Byte *buf, size_t size)>;
+
+
 enum FtpCode {
     // RFC 959 reply code
     COMMAND_OK = 200,
@@ -63,6 +83,31 @@ enum FtpCode {
 };
 
 
+/*
+ * FtpReplyClass
+ * The first digit of the reply code defined in RFC 959
+ */
+enum FtpReplyClass {
+    INVALID_REPLY = 0,
+    POSITIVE_PRELIMINARY = 1,
+    POSITIVE_COMPLETION = 2,
+    POSITIVE_INTERMEDIATE = 3,
+    TRANSIENT_NEGATIVE_COMPLETION = 4,
+    PERMANENT_NEGATIVE_COMPLETION = 5,
+};
+
+
+/*
+ * Transfer modes of the data connection defined in RFC 959 section 3.4, and MODE Z which deflates
+ * the stream mode data
+ */
+enum TransferMode {
+    STREAM_MODE = 'S',
+    BLOCK_MODE = 'B',
+    COMPRESSED_MODE = 'Z',
+};
+
+
 enum NetProtocol {
     UNSPECIFIED = 0,
     IPv4 = 1,
@@ -85,12 +130,70 @@ public:
 };
 
 
+/*
+ * TimeoutException
+ * The exception will be thrown if the socket operation does not complete within its timeout. The
+ * connection is left in an unknown state, so it should be closed
+ */
+class TimeoutException : public SocketException {
+public:
+    explicit TimeoutException(const std::string &operation);
+
+    ~TimeoutException() override;
+
+    const char *what() const noexcept override;
+
+private:
+    std::string _msg;
+};
+
+
+/*
+ * ResolveException
+ * The exception will be thrown if the host name cannot be resolved. getaddrinfo reports its error in
+ * the status it returns instead of errno, so the message is taken from the status
+ */
+class ResolveException : public SocketException {
+public:
+    explicit ResolveException(int status);
+
+    ~ResolveException() override;
+
+    const char *what() const noexcept override;
+
+    /*
+     * Get the status returned by getaddrinfo
+     */
+    int status() const;
+
+private:
+    int _status;
+    std::string _msg;
+};
+
+
+/*
+ * FtpTimeouts struct
+ * Limits of the socket operations of the ftp service. The idle limit applies to every read and write on
+ * control and data connection that makes no progress, and the transfer limit to a whole data transfer.
+ * A limit of 0 waits forever
+ */
+struct FtpTimeouts {
+    std::chrono::milliseconds connect;
+    std::chrono::milliseconds accept;
+    std::chrono::milliseconds idle;
+    std::chrono::milliseconds transfer;
+};
+
+
 /*
  * FtpCtrlReply struct
- * Store the control reply and the reply code from ftp server
+ * Store the control reply and the reply code from ftp server. For multi-line reply,
+ * msg contains every line of the reply
  */
 struct FtpCtrlReply {
     FtpCode code;
+    FtpReplyClass replyClass;
     std::string msg;
 };
 
@@ -120,33 +223,237 @@ public:
     NetProtocol netProtocol() const;
 
     /*
-     * Open data connection in active or passive mode. If passive mode is chosen,
-     * the port parameter will be ignored
+     * Turn on or off the io_uring engine for file transfers through data connection. Function
+     * returns false if io_uring is not available, in which case the blocking sendfile and splice
+     * paths stay in use
+     */
+    bool setIoUringEnabled(bool enabled);
+
+    /*
+     * Check if file transfers use the io_uring engine
+     */
+    bool ioUringEnabled() const;
+
+    /*
+     * Set the transfer mode the server has accepted with MODE command. In compressed mode, the data
+     * sent is deflated and the data read is inflated on the fly with bounded buffers. In block mode,
+     * every transfer is framed with block headers and one data connection carries many transfers.
+     * The mode goes back to stream mode whenever the control connection is opened
+     */
+    void setTransferMode(TransferMode mode);
+
+    /*
+     * Get the transfer mode of the data connection
+     */
+    TransferMode transferMode() const;
+
+    /*
+     * Set the representation type the server has accepted with TYPE command. The type goes back to
+     * ASCII, the default of RFC 959, whenever the control connection is opened
+     */
+    void setTransferType(char type);
+
+    /*
+     * Get the representation type of the data connection
+     */
+    char transferType() const;
+
+    /*
+     * Choose the address of passive data connections: the address advertised in PASV reply, or the
+     * address of the control connection. The control connection address is used by default, since
+     * servers behind NAT often advertise an address that cannot be reached. If the advertised address
+     * does not connect, the control connection address is tried as well
+     */
+    void setUseAdvertisedAddress(bool use);
+
+    /*
+     * Check if passive data connections go to the address advertised in PASV reply
+     */
+    bool useAdvertisedAddress() const;
+
+    /*
+     * Set the range of local ports that active data connections listen on. If portMin is 0, the port is
+     * chosen by the operating system from its ephemeral port range, which is the default
+     */
+    void setActivePortRange(uint16_t portMin, uint16_t portMax);
+
+    /*
+     * Get the range of local ports that active data connections listen on. portMin is 0 if the port
+     * is chosen by the operating system
+     */
+    void activePortRange(uint16_t &portMin, uint16_t &portMax) const;
+
+    /*
+     * Set the tuning of the sockets: TCP_NODELAY of control connection, and buffer sizes, congestion control
+     * and TCP_NOTSENT_LOWAT of data connections. The options take effect on the control connection right
+     * away, and on every data connection opened afterwards. The lan profile is used by default
+     */
+    void setSocketOptions(const SocketOptions &options);
+
+    /*
+     * Get the tuning of the sockets
+     */
+    const SocketOptions &socketOptions() const;
+
+    /*
+     * Set the timeouts of connect, accept, idle read and write, and data transfer. The idle timeout takes
+     * effect on the control connection right away. Operations that time out throw TimeoutException. The
+     * timeouts are not applied to transfers run by the io_uring engine. Timeouts longer than TIMEOUT_MAX
+     * are cut to it
+     */
+    void setTimeouts(const FtpTimeouts &timeouts);
+
+    /*
+     * Get the timeouts of the socket operations
+     */
+    const FtpTimeouts &timeouts() const;
+
+    /*
+     * Limit the rate of every data transfer in bytes per second, with bursts upto burst bytes. Rate 0
+     * turns off the limit. Each transfer starts with a full bucket
+     */
+    void setTransferRateLimit(uint64_t rate, uint64_t burst);
+
+    /*
+     * Get the rate limit of every data transfer
+     */
+    const TokenBucket &transferRateLimit() const;
+
+    /*
+     * Share the rate limit with other ftp services, so that their transfers together stay under it. The
+     * limit may be changed at any time, also while transfers run. Limited transfers do not use io_uring,
+     * and are paced chunk by chunk
+     */
+    void setSharedRateLimit(std::shared_ptr<TokenBucket> limit);
+
+    /*
+     * Get the rate limit shared with other ftp services, or null if there is none
+     */
+    const std::shared_ptr<TokenBucket> &sharedRateLimit() const;
+
+    /*
+     * Report the progress of every data transfer to the callback, at most once per interval and once when
+     * the transfer is done or fails. A null callback turns off reporting. Transfers run by the io_uring engine
+     * only report when they are done
+     */
+    void setProgressCallback(ProgressCallback callback, std::chrono::milliseconds interval);
+
+    /*
+     * Set the size of the next data transfer, so that its progress has a total and an eta. The size only
+     * applies to the next transfer
+     */
+    void setExpectedTransferSize(uint64_t size);
+
+    /*
+     * Keep the listening sockets of active data connections open for the life of the control connection.
+     * The first transfers open a few listening sockets, and the later transfers accept their data connection
+     * on them in turn, instead of opening a new listening socket. Taking turns keeps a new data connection
+     * from reusing the ports of the last one while it is in TIME_WAIT. A port range smaller than the few
+     * sockets, or one whose other ports are taken, is held by as many sockets as it has free ports. The
+     * sockets are closed when this is turned off or the control connection closes
+     */
+    void setKeepListener(bool keep);
+
+    /*
+     * Check if the listening socket of active data connections is kept between transfers
+     */
+    bool keepListener() const;
+
+    /*
+     * Set the delay between connect attempts to the addresses of the host. Control and passive data
+     * connections race non-blocking connects as described in RFC 8305: a new attempt starts after the
+     * delay while the earlier ones keep going, and the first to connect wins
+     */
+    void setConnectAttemptDelay(std::chrono::milliseconds delay);
+
+    /*
+     * Get the delay between connect attempts
+     */
+    std::chrono::milliseconds connectAttemptDelay() const;
+
+    /*
+     * Open data connection in active or passive mode. In active mode, the connection listens on the port.
+     * In passive mode, it connects to the port at the address of the control connection
      */
     void openDataConnect(uint16_t port, bool active);
 
+    /*
+     * Open active data connection listening on a free port of the active port range and return the port,
+     * which is then announced to the server with PORT or EPRT. Ports in use are skipped without any
+     * round trip to the server. If the listening socket is kept, the kept socket and its port are reused.
+     * Throw SocketException if no port of the range is free
+     */
+    void openActiveDataConnect(uint16_t &port);
+
+    /*
+     * Open passive data connection to the port of PASV or EPSV reply. The connection goes to the address
+     * of the control connection resolved when it was opened, so no host name lookup is done. If advertised
+     * address is preferred and the reply has one, the connection goes to advertisedIpAddr instead
+     */
+    void openPassiveDataConnect(const std::string &advertisedIpAddr, uint16_t port);
+
     /*
      * Send the buffer of bytes to the server through data connection
      */
     void sendDataConnect(const std::vector<Byte> &buf);
 
+    /*
+     * Send the data pulled from the source to the server through data connection. The data is
+     * requested in fixed size chunks and each chunk is sent before the next one is requested
+     */
+    void sendDataConnect(const DataSource &source);
+
+    /*
+     * Send length bytes of the file descriptor starting from offset to the server through data
+     * connection. The bytes are copied by the kernel with sendfile, without passing through user space.
+     * Function returns false if the data cannot be read from the file, with errno set to the error;
+     * the transfer stops there
+     */
+    bool sendDataConnect(int fd, off_t offset, size_t length);
+
     /*
      * Read the data back from the ftp server through data connection
      */
     void readDataReply(std::vector<Byte> &buf);
 
     /*
-     * Close the data connection with the fpt server
+     * Read the data back from the ftp server through data connection and pass it to the sink
+     * in fixed size chunks as soon as they arrive. Memory use does not depend on the transfer size
+     */
+    void readDataReply(const DataSink &sink);
+
+    /*
+     * Read the data back from the ftp server through data connection and write it to the file
+     * descriptor. The bytes are moved by the kernel through a pipe with splice, without passing
+     * through user space. Function returns false if the data cannot be written to the file, with
+     * errno set to the error; nothing more is written to the file after that
+     */
+    bool readDataReply(int fd);
+
+    /*
+     * Check if the data connection of the last transfer is still open and can carry the next transfer
+     * without PASV or PORT command. It is only the case in block mode
+     */
+    bool dataConnectOpen() const;
+
+    /*
+     * Close the data connection with the fpt server. In block mode, the connection is kept open for the
+     * next transfer
      */
     void closeDataConnect();
 
     /*
-     * Open control connection with the server
+     * Close the data connection with the ftp server, even in block mode
+     */
+    void shutdownDataConnect();
+
+    /*
+     * Open control connection with the server. Throw ResolveException if the host name cannot be resolved
      */
     void openCtrlConnect(const std::string &hostname, uint16_t port);
 
     /*
-     * Read the control reply from server
+     * Read the control reply from server. Multi-line reply is read completely
      */
     void readCtrlReply(FtpCtrlReply &reply);
 
@@ -180,6 +487,26 @@ public:
      */
     void sendLIST(const std::string &path);
 
+    /*
+     * Send NLST command to the ftp server
+     */
+    void sendNLST(const std::string &path);
+
+    /*
+     * Send FEAT command to the ftp server
+     */
+    void sendFEAT();
+
+    /*
+     * Send MODE command to the ftp server
+     */
+    void sendMODE(TransferMode mode);
+
+    /*
+     * Send NOOP command to the ftp server
+     */
+    void sendNOOP();
+
     /*
      * Send QUIT command to the ftp server
      */
@@ -215,6 +542,51 @@ public:
      */
     void sendSTOR(const std::string &filePath);
 
+    /*
+     * Send APPE command to the ftp server
+     */
+    void sendAPPE(const std::string &filePath);
+
+    /*
+     * Send TYPE command to the ftp server
+     */
+    void sendTYPE(char type);
+
+    /*
+     * Send REST command to the ftp server
+     */
+    void sendREST(uint64_t offset);
+
+    /*
+     * Send SIZE command to the ftp server
+     */
+    void sendSIZE(const std::string &filePath);
+
+    /*
+     * Send MDTM command to the ftp server
+     */
+    void sendMDTM(const std::string &filePath);
+
+    /*
+     * Send DELE command to the ftp server
+     */
+    void sendDELE(const std::string &filePath);
+
+    /*
+     * Send the commands, e.g. "SIZE file", to the ftp server without waiting for the reply of each command
+     * before sending the next one, then read back the final reply of every command in order. Commands are
+     * written in batches with a single send, and at most PIPELINE_WINDOW commands are waiting for reply at
+     * a time. Only commands that do not open data connection should be pipelined. The server closes the
+     * connection after a 421 reply, so the replies stop at the 421 reply and there are fewer replies than
+     * commands
+     */
+    void sendPipelined(const std::vector<std::string> &cmds, std::vector<FtpCtrlReply> &replies);
+
+    /*
+     * Send SIZE command for every file path to the ftp server pipelined, as sendPipelined does
+     */
+    void sendPipelinedSIZE(const std::vector<std::string> &filePaths, std::vector<FtpCtrlReply> &replies);
+
     /*
      * Parse the PASV reply to get the port number and ip address for data connection
      */
@@ -229,6 +601,15 @@ public:
 
     static const uint16_t USABLE_PORT_MAX  = std::numeric_limits<uint16_t>::max();
 
+    static const size_t PIPELINE_WINDOW = 64;
+
+    static constexpr std::chrono::milliseconds CONNECT_ATTEMPT_DELAY{250};
+
+    // poll and TCP_USER_TIMEOUT take the timeout in milliseconds as an int
+    static constexpr std::chrono::milliseconds TIMEOUT_MAX{std::numeric_limits<int>::max()};
+
+    static const FtpTimeouts DEFAULT_TIMEOUTS;
+
 private:
     struct Impl;
     std::unique_ptr<Impl> _impl;
@@ -0,0 +1,165 @@
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include "FtpSession.h"
+
+
+/*
+ * Helper function to write size bytes of buffer at offset of the file. Function returns false
+ * if the write fails
+ */
+static bool pwriteEnsure(int fd, const Byte *buf, size_t size, uint64_t offset) {
+    size_t writeSofar = 0;
+    while (writeSofar < size) {
+        auto wn = pwrite(fd, buf + writeSofar, size - writeSofar, static_cast<off_t>(offset + writeSofar));
+        if (wn == -1 && errno == EINTR)
+            continue;
+
+        if (wn == -1)
+            return false;
+
+        writeSofar += static_cast<size_t>(wn);
+    }
+
+    return true;
+}
+
+
+FtpSession::FtpSession(AsyncLog *log)
+    : _logger{log}, _ftp{&_logger}
+{
+    _lastReply.code = static_cast<FtpCode>(0);
+    _lastReply.replyClass = INVALID_REPLY;
+}
+
+
+FtpSession::~FtpSession() {}
+
+
+FtpService &FtpSession::ftp() {
+    return _ftp;
+}
+
+
+const FtpCtrlReply &FtpSession::lastReply() const {
+    return _lastReply;
+}
+
+
+bool FtpSession::login(const std::string &hostname, uint16_t port, const std::string &user, const std::string &password) {
+    _ftp.openCtrlConnect(hostname, port);
+    if (readReply().code != SERVICE_READY)
+        return false;
+
+    _ftp.sendUSER(user);
+    readReply();
+    if (_lastReply.code == USER_OK_PASSWORD_NEEDED) {
+        _ftp.sendPASS(password);
+        readReply();
+    }
+    if (_lastReply.code != USER_LOGGED_IN_PROCCEED)
+        return false;
+
+    _ftp.sendTYPE('I');
+    return readReply().code == COMMAND_OK;
+}
+
+
+void FtpSession::logout() {
+    _ftp.sendQUIT();
+    readReply();
+    _ftp.closeCtrlConnect();
+}
+
+
+bool FtpSession::noop() {
+    _ftp.sendNOOP();
+    return readReply().code == COMMAND_OK;
+}
+
+
+bool FtpSession::remoteSize(const std::string &remotePath, uint64_t &size) {
+    _ftp.sendSIZE(remotePath);
+    if (readReply().code != FILE_STATUS)
+        return false;
+
+    // reply looks like "213 <size>\r\n"
+    return toUnsignedInt(trimString(_lastReply.msg.substr(4)), size) == 0;
+}
+
+
+bool FtpSession::retrieve(const std::string &remotePath, int fd, uint64_t offset, uint64_t length, uint64_t &received) {
+    received = 0;
+    if (!openPassiveDataConnect())
+        return false;
+
+    if (offset > 0) {
+        _ftp.sendREST(offset);
+        if (readReply().code != REQUESTED_FILE_ACTION_PENDING_FOR_FURTHER_INFO) {
+            _ftp.closeDataConnect();
+            return false;
+        }
+    }
+
+    _ftp.sendRETR(remotePath);
+    readReply();
+    if (_lastReply.code != FILE_STATUS_OK_OPEN_DATA_CONNECTION && _lastReply.code != DATA_CONNECTION_OPEN_TRANSFER_STARTING) {
+        _ftp.closeDataConnect();
+        return false;
+    }
+
+    bool writeFailed = false;
+    _ftp.readDataReply([&](const Byte *buf, size_t size) {
+        size_t n = length == 0 ? size : static_cast<size_t>(std::min<uint64_t>(size, length - received));
+        if (!pwriteEnsure(fd, buf, n, offset + received)) {
+            writeFailed = true;
+            return false;
+        }
+
+        received += n;
+        return length == 0 || received < length;
+    });
+    _ftp.closeDataConnect();
+
+    // server may report the transfer as aborted if the range ended before the end of file
+    readReply();
+    if (writeFailed)
+        return false;
+
+    if (length != 0 && received == length)
+        return true;
+
+    return _lastReply.code == CLOSE_DATA_CONNECTION_REQUEST_FILE_ACTION_SUCCESS || _lastReply.code == REQUESTED_FILE_ACTION_COMPLETED;
+}
+
+
+const FtpCtrlReply &FtpSession::readReply() {
+    _ftp.readCtrlReply(_lastReply);
+    return _lastReply;
+}
+
+
+bool FtpSession::openPassiveDataConnect() {
+    if (_ftp.dataConnectOpen())
+        return true;
+
+    uint16_t passivePort;
+    std::string ipAddr;
+    if (_ftp.netProtocol() == IPv6) {
+        _ftp.sendEPSV(false, IPv6);
+        if (readReply().code != ENTERING_EXTENDED_PASSIVE_MODE)
+            return false;
+
+        FtpService::parseEPSVReply(_lastReply.msg, passivePort);
+    }
+    else {
+        _ftp.sendPASV();
+        if (readReply().code != ENTERING_PASSIVE_MODE)
+            return false;
+
+        FtpService::parsePASVReply(_lastReply.msg, ipAddr, passivePort);
+    }
+
+    _ftp.openPassiveDataConnect(ipAddr, passivePort);
+    return true;
+}
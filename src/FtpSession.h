@@ -0,0 +1,80 @@
+#ifndef FTPSESSION_H
+#define FTPSESSION_H
+
+#include <string>
+#include "FtpService.h"
+#include "Utility.h"
+
+
+/*
+ * FtpSession class
+ * A logged in control connection with its own FtpService and log stream, so that it can run
+ * transfers on a thread other than the interactive one. Data connections of the session are
+ * always opened in passive mode
+ */
+class FtpSession {
+public:
+    explicit FtpSession(AsyncLog *log);
+
+    FtpSession(const FtpSession &) = delete;
+
+    FtpSession &operator=(const FtpSession &) = delete;
+
+    ~FtpSession();
+
+    /*
+     * Get the ftp service of the session
+     */
+    FtpService &ftp();
+
+    /*
+     * Get the last control reply received by the session
+     */
+    const FtpCtrlReply &lastReply() const;
+
+    /*
+     * Connect to the ftp server, log in and switch to binary type. Function returns false
+     * if the server refuses any step
+     */
+    bool login(const std::string &hostname, uint16_t port, const std::string &user, const std::string &password);
+
+    /*
+     * Send QUIT command and close the control connection
+     */
+    void logout();
+
+    /*
+     * Send NOOP command to check if the session is still alive. Function returns false if the
+     * server does not reply with success
+     */
+    bool noop();
+
+    /*
+     * Get the size of the remote file. Function returns false if the server refuses SIZE command
+     */
+    bool remoteSize(const std::string &remotePath, uint64_t &size);
+
+    /*
+     * Retrieve the remote file starting from offset and write it at the same offset of the local file
+     * with positional writes. If length is not 0, the transfer stops after length bytes. Function returns
+     * false if the server refuses the transfer or the local file cannot be written
+     */
+    bool retrieve(const std::string &remotePath, int fd, uint64_t offset, uint64_t length, uint64_t &received);
+
+private:
+    /*
+     * Helper function to read the control reply into the last reply
+     */
+    const FtpCtrlReply &readReply();
+
+    /*
+     * Helper function to open passive data connection
+     */
+    bool openPassiveDataConnect();
+
+    LogStream _logger;
+    FtpService _ftp;
+    FtpCtrlReply _lastReply;
+};
+
+#endif // FTPSESSION_H
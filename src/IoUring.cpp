@@ -0,0 +1,397 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <vector>
+#include "FtpService.h"
+#include "IoUring.h"
+
+#ifdef FTP_CLIENT_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+
+static const unsigned URING_BATCH_MAX    = 8;
+static const unsigned URING_BUFFER_COUNT = URING_BATCH_MAX * 2;
+static const size_t URING_CHUNK_SIZE     = 65536;
+
+
+#ifdef FTP_CLIENT_HAVE_IO_URING
+
+struct IoUringEngine::Impl {
+    /*
+     * One piece of a batch: read into a registered buffer then write it out
+     */
+    struct Piece {
+        size_t length;
+        int readRes;
+        int writeRes;
+    };
+
+
+    /*
+     * Helper function to set up the ring, map the queues and register the buffers
+     */
+    void setup() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringfd = static_cast<int>(syscall(__NR_io_uring_setup, URING_BUFFER_COUNT, &params));
+        if (ringfd == -1)
+            throw SocketException();
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+            throw SocketException();
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            cqRing = sqRing;
+        else {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED)
+                throw SocketException();
+        }
+
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+        if (sqesMap == MAP_FAILED)
+            throw SocketException();
+        sqes = static_cast<io_uring_sqe *>(sqesMap);
+
+        auto sqBase = static_cast<char *>(sqRing);
+        sqTail  = reinterpret_cast<unsigned *>(sqBase + params.sq_off.tail);
+        sqMask  = *reinterpret_cast<unsigned *>(sqBase + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sqBase + params.sq_off.array);
+
+        auto cqBase = static_cast<char *>(cqRing);
+        cqHead = reinterpret_cast<unsigned *>(cqBase + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cqBase + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cqBase + params.cq_off.ring_mask);
+        cqes   = reinterpret_cast<io_uring_cqe *>(cqBase + params.cq_off.cqes);
+
+        // register the buffers once so the kernel does not map them on every request
+        buffers.resize(URING_BUFFER_COUNT * URING_CHUNK_SIZE);
+        std::vector<iovec> iovs(URING_BUFFER_COUNT);
+        for (unsigned i = 0; i < URING_BUFFER_COUNT; ++i) {
+            iovs[i].iov_base = buffers.data() + i * URING_CHUNK_SIZE;
+            iovs[i].iov_len  = URING_CHUNK_SIZE;
+        }
+
+        if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_BUFFERS, iovs.data(), URING_BUFFER_COUNT) == -1)
+            throw SocketException();
+    }
+
+
+    /*
+     * Helper function to release the ring
+     */
+    void teardown() {
+        if (sqes)
+            munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing && cqRing != MAP_FAILED)
+            munmap(cqRing, cqRingSize);
+        if (sqRing && sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (ringfd != -1)
+            close(ringfd);
+    }
+
+
+    /*
+     * Helper function to get the buffer of a piece
+     */
+    Byte *buffer(unsigned piece) {
+        return buffers.data() + piece * URING_CHUNK_SIZE;
+    }
+
+
+    /*
+     * Helper function to queue one submission entry
+     */
+    void queue(unsigned char opcode, int fd, unsigned piece, size_t length, off_t offset, int msgFlags, bool link, uint64_t userData) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode    = opcode;
+        sqe.fd        = fd;
+        sqe.addr      = reinterpret_cast<uint64_t>(buffer(piece));
+        sqe.len       = static_cast<unsigned>(length);
+        sqe.off       = static_cast<uint64_t>(offset);
+        sqe.flags     = link ? IOSQE_IO_LINK : 0;
+        sqe.user_data = userData;
+        if (opcode == IORING_OP_READ_FIXED || opcode == IORING_OP_WRITE_FIXED)
+            sqe.buf_index = static_cast<uint16_t>(piece);
+        else
+            sqe.msg_flags = static_cast<unsigned>(msgFlags);
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+
+    /*
+     * Helper function to submit the queued entries and wait until all of them complete
+     */
+    void submitAndWait(unsigned count, std::vector<Piece> &pieces) {
+        unsigned submitted = 0, completed = 0;
+        while (completed < count) {
+            auto rn = syscall(__NR_io_uring_enter, ringfd, count - submitted, count - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (rn == -1 && errno == EINTR)
+                continue;
+
+            if (rn == -1)
+                throw SocketException();
+
+            submitted += static_cast<unsigned>(rn);
+
+            unsigned head = *cqHead;
+            while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe &cqe = cqes[head & cqMask];
+                Piece &piece = pieces[cqe.user_data / 2];
+                if (cqe.user_data % 2 == 0)
+                    piece.readRes = cqe.res;
+                else
+                    piece.writeRes = cqe.res;
+
+                ++head;
+                ++completed;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+
+
+    int ringfd = -1;
+    void *sqRing = nullptr;
+    void *cqRing = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+    unsigned *sqTail = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+    std::vector<Byte> buffers;
+};
+
+
+/*
+ * Helper function to fail with the error of a completion result
+ */
+static void throwCompletionError(int res) {
+    errno = -res;
+    throw SocketException();
+}
+
+
+IoUringEngine::IoUringEngine() {
+    _impl = std::make_unique<Impl>();
+    try {
+        _impl->setup();
+    } catch (...) {
+        _impl->teardown();
+        throw;
+    }
+}
+
+
+IoUringEngine::~IoUringEngine() {
+    _impl->teardown();
+}
+
+
+bool IoUringEngine::available() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, 1, &params));
+    if (fd == -1)
+        return false;
+
+    close(fd);
+    return true;
+}
+
+
+size_t IoUringEngine::receiveToFile(int sockfd, int fd, int &writeError) {
+    off_t startOffset = lseek(fd, 0, SEEK_CUR);
+    if (startOffset == -1)
+        throw SocketException();
+
+    // a batch received into one half of the buffers is written while the next batch is received into
+    // the other half. Every write is queued once its piece is received, with the length received, so the
+    // file never gets bytes past the data
+    std::vector<Impl::Piece> pieces(URING_BUFFER_COUNT);
+    std::vector<off_t> offsets(URING_BUFFER_COUNT);
+    off_t receivedOffset = startOffset, writtenOffset = startOffset;
+    unsigned half = 0, writeCount = 0;
+    bool eof = false;
+    while (!eof || writeCount > 0) {
+        unsigned recvFirst  = half * URING_BATCH_MAX;
+        unsigned writeFirst = (1 - half) * URING_BATCH_MAX;
+        for (unsigned i = writeFirst; i < writeFirst + writeCount; ++i)
+            _impl->queue(IORING_OP_WRITE_FIXED, fd, i, pieces[i].length, offsets[i], 0, false, i * 2 + 1);
+
+        // chain the receives so they take the data of the socket in order
+        unsigned recvCount = eof ? 0 : URING_BATCH_MAX;
+        for (unsigned i = recvFirst; i < recvFirst + recvCount; ++i) {
+            pieces[i] = {URING_CHUNK_SIZE, -ECANCELED, -ECANCELED};
+            _impl->queue(IORING_OP_RECV, sockfd, i, URING_CHUNK_SIZE, 0, MSG_WAITALL, i + 1 < recvFirst + recvCount, i * 2);
+        }
+        _impl->submitAndWait(writeCount + recvCount, pieces);
+
+        for (unsigned i = writeFirst; i < writeFirst + writeCount; ++i) {
+            const Impl::Piece &piece = pieces[i];
+            if (piece.writeRes < 0) {
+                writeError = -piece.writeRes;
+                return static_cast<size_t>(writtenOffset - startOffset);
+            }
+
+            // finish the part of a short write
+            auto written = static_cast<size_t>(piece.writeRes);
+            while (written < piece.length) {
+                auto wn = pwrite(fd, _impl->buffer(i) + written, piece.length - written, offsets[i] + static_cast<off_t>(written));
+                if (wn == -1 && errno == EINTR)
+                    continue;
+
+                if (wn == -1) {
+                    writeError = errno;
+                    return static_cast<size_t>(writtenOffset - startOffset);
+                }
+
+                written += static_cast<size_t>(wn);
+            }
+
+            writtenOffset = offsets[i] + static_cast<off_t>(piece.length);
+        }
+
+        // a short receive breaks the chain, and the receives after it are cancelled
+        writeCount = 0;
+        for (unsigned i = recvFirst; i < recvFirst + recvCount; ++i) {
+            Impl::Piece &piece = pieces[i];
+            if (piece.readRes == -ECANCELED)
+                break;
+
+            if (piece.readRes < 0)
+                throwCompletionError(piece.readRes);
+
+            if (piece.readRes == 0) {
+                eof = true;
+                break;
+            }
+
+            piece.length = static_cast<size_t>(piece.readRes);
+            offsets[i] = receivedOffset;
+            receivedOffset += piece.readRes;
+            ++writeCount;
+        }
+
+        half = 1 - half;
+    }
+
+    lseek(fd, writtenOffset, SEEK_SET);
+    return static_cast<size_t>(writtenOffset - startOffset);
+}
+
+
+size_t IoUringEngine::sendFromFile(int sockfd, int fd, off_t offset, size_t length) {
+    std::vector<Impl::Piece> pieces(URING_BATCH_MAX);
+    size_t sentSofar = 0;
+    bool eof = false;
+    while (sentSofar < length && !eof) {
+        // chain read(file) -> send(socket) for every buffer of the batch
+        unsigned count = 0;
+        size_t queued = sentSofar;
+        while (count < URING_BATCH_MAX && queued < length) {
+            size_t pieceLength = std::min(URING_CHUNK_SIZE, length - queued);
+            bool last = count + 1 == URING_BATCH_MAX || queued + pieceLength == length;
+            off_t pieceOffset = offset + static_cast<off_t>(queued);
+            pieces[count] = {pieceLength, -ECANCELED, -ECANCELED};
+            _impl->queue(IORING_OP_READ_FIXED, fd, count, pieceLength, pieceOffset, 0, true, count * 2);
+            _impl->queue(IORING_OP_SEND, sockfd, count, pieceLength, 0, MSG_WAITALL | MSG_NOSIGNAL, !last, count * 2 + 1);
+            queued += pieceLength;
+            ++count;
+        }
+        _impl->submitAndWait(count * 2, pieces);
+
+        for (unsigned i = 0; i < count; ++i) {
+            const Impl::Piece &piece = pieces[i];
+            if (piece.readRes < 0)
+                throwCompletionError(piece.readRes);
+
+            if (piece.writeRes < 0 && piece.writeRes != -ECANCELED)
+                throwCompletionError(piece.writeRes);
+
+            auto read = static_cast<size_t>(piece.readRes);
+            auto sent = piece.writeRes < 0 ? size_t{0} : static_cast<size_t>(piece.writeRes);
+
+            // finish the part of a short piece that the chain did not send
+            while (sent < read) {
+                auto wn = send(sockfd, _impl->buffer(i) + sent, read - sent, MSG_NOSIGNAL);
+                if (wn == -1 && errno == EINTR)
+                    continue;
+
+                if (wn == -1)
+                    throw SocketException();
+
+                sent += static_cast<size_t>(wn);
+            }
+
+            sentSofar += sent;
+
+            // file is shorter than expected
+            if (read < piece.length)
+                eof = true;
+
+            if (read < piece.length || sent < piece.length)
+                break;
+        }
+    }
+
+    return sentSofar;
+}
+
+#else
+
+struct IoUringEngine::Impl {};
+
+
+IoUringEngine::IoUringEngine() {
+    errno = ENOSYS;
+    throw SocketException();
+}
+
+
+IoUringEngine::~IoUringEngine() {}
+
+
+bool IoUringEngine::available() {
+    return false;
+}
+
+
+size_t IoUringEngine::receiveToFile(int, int, int &) {
+    errno = ENOSYS;
+    throw SocketException();
+}
+
+
+size_t IoUringEngine::sendFromFile(int, int, off_t, size_t) {
+    errno = ENOSYS;
+    throw SocketException();
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <memory>
+#include <sys/types.h>
+
+
+/*
+ * IoUringEngine class
+ * Move data between a data socket and a file with io_uring. The engine owns a small set of
+ * registered buffers and submits each batch of transfers with a single io_uring_enter syscall
+ * instead of one read and one write per chunk. Uploads chain read -> send requests of known
+ * length, downloads write one batch while receiving the next. Throw SocketException if io_uring
+ * cannot be set up or a transfer fails
+ */
+class IoUringEngine {
+public:
+    IoUringEngine();
+
+    IoUringEngine(const IoUringEngine &) = delete;
+
+    IoUringEngine &operator=(const IoUringEngine &) = delete;
+
+    ~IoUringEngine();
+
+    /*
+     * Check if io_uring is supported by the build and the running kernel
+     */
+    static bool available();
+
+    /*
+     * Receive data from the socket until the peer closes the connection and write it to the file
+     * descriptor starting from its current offset. If the file cannot be written, writeError is set to
+     * the error and the transfer stops. Function returns the number of bytes written to the file
+     */
+    size_t receiveToFile(int sockfd, int fd, int &writeError);
+
+    /*
+     * Send length bytes of the file descriptor starting from offset to the socket.
+     * Function returns the number of bytes sent
+     */
+    size_t sendFromFile(int sockfd, int fd, off_t offset, size_t length);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+#endif // IOURING_H
@@ -0,0 +1,90 @@
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "PartialFile.h"
+#include "Utility.h"
+
+
+const std::string PartialFile::SUFFIX = ".part";
+
+
+PartialFile::PartialFile(const std::string &path)
+    : _destination{path}, _partPath{path + SUFFIX}, _fd{-1}, _inPlace{false}, _keep{false}, _committed{false}
+{}
+
+
+PartialFile::~PartialFile() {
+    closeFile();
+    if (!_committed && !_keep && !_inPlace)
+        std::remove(_partPath.c_str());
+}
+
+
+bool PartialFile::open(bool resume) {
+    closeFile();
+    _inPlace = false;
+    if (!resume) {
+        _fd = ::open(_partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return _fd != -1;
+    }
+
+    _fd = ::open(_partPath.c_str(), O_WRONLY | O_CLOEXEC);
+    if (_fd == -1 && isRegularFile(_destination)) {
+        _fd = ::open(_destination.c_str(), O_WRONLY | O_CLOEXEC);
+        _inPlace = _fd != -1;
+    }
+
+    if (_fd == -1)
+        _fd = ::open(_partPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+    return _fd != -1 && lseek(_fd, 0, SEEK_END) != -1;
+}
+
+
+bool PartialFile::restart() {
+    if (_inPlace)
+        return open(false);
+
+    return ftruncate(_fd, 0) == 0 && lseek(_fd, 0, SEEK_SET) == 0;
+}
+
+
+int PartialFile::fd() const {
+    return _fd;
+}
+
+
+off_t PartialFile::size() const {
+    return fileSizeOf(_fd);
+}
+
+
+const std::string &PartialFile::path() const {
+    return _inPlace ? _destination : _partPath;
+}
+
+
+void PartialFile::keep() {
+    _keep = true;
+}
+
+
+bool PartialFile::commit() {
+    closeFile();
+    if (!_inPlace && std::rename(_partPath.c_str(), _destination.c_str()) != 0) {
+        _keep = true;
+        return false;
+    }
+
+    _committed = true;
+    return true;
+}
+
+
+void PartialFile::closeFile() {
+    if (_fd == -1)
+        return;
+
+    close(_fd);
+    _fd = -1;
+}
@@ -0,0 +1,81 @@
+#ifndef PARTIALFILE_H
+#define PARTIALFILE_H
+
+#include <string>
+#include <sys/types.h>
+
+
+/*
+ * PartialFile class
+ * Local file of a download in progress. The data goes to a partial file next to the destination, which
+ * replaces the destination only once the download completes, so a download that fails never destroys
+ * an existing local file. The partial file is removed when the object goes out of scope before commit,
+ * unless it is kept for a later resume
+ */
+class PartialFile {
+public:
+    explicit PartialFile(const std::string &path);
+
+    PartialFile(const PartialFile &) = delete;
+
+    PartialFile &operator=(const PartialFile &) = delete;
+
+    ~PartialFile();
+
+    /*
+     * Open the file for writing at its end. A fresh download starts with an empty partial file. A resumed
+     * download continues the partial file, or the destination itself if there is no partial file, since it
+     * was left by an earlier download that did not go through a partial file. Function returns false if
+     * the file cannot be opened
+     */
+    bool open(bool resume);
+
+    /*
+     * Start the download over with an empty partial file. The destination is never truncated.
+     * Function returns false if the partial file cannot be opened
+     */
+    bool restart();
+
+    /*
+     * Get the file descriptor to write the download to
+     */
+    int fd() const;
+
+    /*
+     * Get the number of bytes already in the file, or -1 if the size cannot be retrieved
+     */
+    off_t size() const;
+
+    /*
+     * Get the path the download is written to
+     */
+    const std::string &path() const;
+
+    /*
+     * Keep the partial file when the object goes out of scope, so that the download can be resumed later
+     */
+    void keep();
+
+    /*
+     * Close the file and move it over the destination. Function returns false if it cannot be renamed,
+     * and the complete file is kept at its partial path
+     */
+    bool commit();
+
+    static const std::string SUFFIX;
+
+private:
+    /*
+     * Helper function to close the file descriptor
+     */
+    void closeFile();
+
+    std::string _destination;
+    std::string _partPath;
+    int _fd;
+    bool _inPlace;
+    bool _keep;
+    bool _committed;
+};
+
+#endif // PARTIALFILE_H
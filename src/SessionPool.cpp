@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <iterator>
+#include "SessionPool.h"
+
+
+/*
+ * Helper function to log out of the session, ignoring any error since the session is thrown away anyway
+ */
+static void closeSession(std::unique_ptr<FtpSession> session) {
+    try {
+        session->logout();
+    } catch (const std::exception &) {
+    }
+}
+
+
+SessionPool::Lease::Lease(SessionPool *pool, std::unique_ptr<FtpSession> session)
+    : _pool{pool}, _session{std::move(session)}, _healthy{true}
+{}
+
+
+SessionPool::Lease::Lease(Lease &&other)
+    : _pool{other._pool}, _session{std::move(other._session)}, _healthy{other._healthy}
+{}
+
+
+SessionPool::Lease::~Lease() {
+    if (_session)
+        _pool->release(std::move(_session), _healthy);
+}
+
+
+FtpSession *SessionPool::Lease::operator->() const {
+    return _session.get();
+}
+
+
+FtpSession &SessionPool::Lease::operator*() const {
+    return *_session;
+}
+
+
+SessionPool::Lease::operator bool() const {
+    return _session != nullptr;
+}
+
+
+void SessionPool::Lease::discard() {
+    _healthy = false;
+}
+
+
+SessionPool::SessionPool(Factory factory, size_t capacity, std::chrono::seconds healthCheckInterval)
+    : _factory{std::move(factory)}, _capacity{capacity}, _open{0}, _healthCheckInterval{healthCheckInterval}, _stopping{false}
+{
+    _maintainer = std::thread([this]() { maintain(); });
+}
+
+
+SessionPool::~SessionPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _maintenance.notify_all();
+    _maintainer.join();
+
+    for (auto &idle : _idle)
+        closeSession(std::move(idle.session));
+}
+
+
+size_t SessionPool::capacity() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _capacity;
+}
+
+
+void SessionPool::grow(size_t capacity) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (capacity <= _capacity)
+            return;
+
+        _capacity = capacity;
+    }
+
+    // waiting borrowers may open a session now, and the background thread fills the new room
+    _returned.notify_all();
+    _maintenance.notify_one();
+}
+
+
+size_t SessionPool::idle() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _idle.size();
+}
+
+
+SessionPool::Lease SessionPool::acquire() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _returned.wait(lock, [this]() { return !_idle.empty() || _open < _capacity; });
+        if (!_idle.empty()) {
+            // most recently returned session is the least likely to be timed out by the server
+            auto session = std::move(_idle.back().session);
+            _idle.pop_back();
+            return Lease(this, std::move(session));
+        }
+
+        ++_open;
+    }
+
+    // log in outside of the lock so several sessions can be opened at the same time
+    std::unique_ptr<FtpSession> session;
+    try {
+        session = _factory();
+    } catch (...) {
+        release(nullptr, false);
+        throw;
+    }
+
+    if (!session)
+        release(nullptr, false);
+
+    return Lease(this, std::move(session));
+}
+
+
+void SessionPool::release(std::unique_ptr<FtpSession> session, bool healthy) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (session && healthy) {
+            _idle.push_back({std::move(session), std::chrono::steady_clock::now()});
+            _returned.notify_one();
+            return;
+        }
+
+        --_open;
+        _returned.notify_one();
+    }
+
+    // let the background thread replace the broken session
+    _maintenance.notify_one();
+
+    if (session)
+        closeSession(std::move(session));
+}
+
+
+void SessionPool::maintain() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stopping) {
+        lock.unlock();
+        checkIdleSessions();
+        bool filled = fillPool();
+        lock.lock();
+
+        // retry a failed login only at the next health check
+        _maintenance.wait_for(lock, _healthCheckInterval, [this, filled]() { return _stopping || (filled && _open < _capacity); });
+    }
+}
+
+
+void SessionPool::checkIdleSessions() {
+    // take the sessions due for a check out of the pool, so they are not lent out in the meantime
+    std::vector<IdleSession> due;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto now = std::chrono::steady_clock::now();
+        auto stale = std::partition(_idle.begin(), _idle.end(), [this, now](const IdleSession &idle) {
+            return now - idle.since < _healthCheckInterval;
+        });
+        std::move(stale, _idle.end(), std::back_inserter(due));
+        _idle.erase(stale, _idle.end());
+    }
+
+    for (auto &idle : due) {
+        bool healthy;
+        try {
+            healthy = idle.session->noop();
+        } catch (const std::exception &) {
+            healthy = false;
+        }
+
+        release(std::move(idle.session), healthy);
+    }
+}
+
+
+bool SessionPool::fillPool() {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stopping || _open >= _capacity)
+                return true;
+
+            ++_open;
+        }
+
+        std::unique_ptr<FtpSession> session;
+        try {
+            session = _factory();
+        } catch (const std::exception &) {
+        }
+
+        if (!session) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_open;
+            _returned.notify_one();
+            return false;
+        }
+
+        release(std::move(session), true);
+    }
+}
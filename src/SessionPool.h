@@ -0,0 +1,128 @@
+#ifndef SESSIONPOOL_H
+#define SESSIONPOOL_H
+
+#include <memory>
+#include <functional>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include "FtpSession.h"
+
+
+/*
+ * SessionPool class
+ * Keep a fixed number of logged in sessions to the same ftp server and lend them out, so that
+ * concurrent transfers do not pay the connect and login round trips every time. A background thread
+ * opens sessions until the pool is full, checks the sessions that stay idle with NOOP, and replaces
+ * the sessions that are broken
+ */
+class SessionPool {
+public:
+    using Factory = std::function<std::unique_ptr<FtpSession>()>;
+
+    /*
+     * Lease class
+     * A session borrowed from the pool. The session goes back to the pool when the lease is destroyed,
+     * unless it is discarded because it is broken
+     */
+    class Lease {
+    public:
+        Lease(SessionPool *pool, std::unique_ptr<FtpSession> session);
+
+        Lease(Lease &&other);
+
+        Lease(const Lease &) = delete;
+
+        Lease &operator=(const Lease &) = delete;
+
+        ~Lease();
+
+        FtpSession *operator->() const;
+
+        FtpSession &operator*() const;
+
+        explicit operator bool() const;
+
+        /*
+         * Mark the session as broken, it will be closed instead of going back to the pool
+         */
+        void discard();
+
+    private:
+        SessionPool *_pool;
+        std::unique_ptr<FtpSession> _session;
+        bool _healthy;
+    };
+
+    SessionPool(Factory factory, size_t capacity, std::chrono::seconds healthCheckInterval = std::chrono::seconds(30));
+
+    SessionPool(const SessionPool &) = delete;
+
+    SessionPool &operator=(const SessionPool &) = delete;
+
+    ~SessionPool();
+
+    /*
+     * Get the maximum number of sessions of the pool
+     */
+    size_t capacity();
+
+    /*
+     * Raise the maximum number of sessions of the pool to capacity. The pool never shrinks, so the
+     * sessions already open are kept, and a smaller capacity is ignored
+     */
+    void grow(size_t capacity);
+
+    /*
+     * Get the number of sessions that are idle in the pool
+     */
+    size_t idle();
+
+    /*
+     * Borrow a session. An idle session is reused if any, otherwise a new one is opened if the pool is
+     * not full, otherwise wait until a session is returned. The lease is empty if a new session cannot
+     * be logged in
+     */
+    Lease acquire();
+
+private:
+    struct IdleSession {
+        std::unique_ptr<FtpSession> session;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    /*
+     * Helper function run by the background thread to keep the pool full and healthy
+     */
+    void maintain();
+
+    /*
+     * Helper function to check the sessions that are idle for longer than the health check interval
+     */
+    void checkIdleSessions();
+
+    /*
+     * Helper function to open sessions until the pool is full. Function returns false if the factory fails
+     */
+    bool fillPool();
+
+    /*
+     * Helper function to take the session back from a lease
+     */
+    void release(std::unique_ptr<FtpSession> session, bool healthy);
+
+    Factory _factory;
+    size_t _capacity;
+    size_t _open;
+    std::chrono::seconds _healthCheckInterval;
+    std::vector<IdleSession> _idle;
+    bool _stopping;
+    std::mutex _mutex;
+    std::condition_variable _returned;
+    std::condition_variable _maintenance;
+    std::thread _maintainer;
+};
+
+#endif // SESSIONPOOL_H
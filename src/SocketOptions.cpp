@@ -0,0 +1,130 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <errno.h>
+#include <fstream>
+#include "SocketOptions.h"
+#include "Utility.h"
+
+
+// largest socket buffers an unprivileged process may ask for
+static const char RMEM_MAX_PATH[] = "/proc/sys/net/core/rmem_max";
+static const char WMEM_MAX_PATH[] = "/proc/sys/net/core/wmem_max";
+
+
+/*
+ * Helper function to set the integer socket option. Value 0 keeps the system default
+ */
+static void setSocketOption(int sockfd, int level, int option, const char *optionName, int value, std::ostream &log) {
+    if (value == 0)
+        return;
+
+    if (setsockopt(sockfd, level, option, &value, sizeof(value)) == -1)
+        logDateTime(log) << "Cannot set " << optionName << " to " << value << ": " << strerror(errno) << std::endl;
+}
+
+
+/*
+ * Helper function to read the system limit of socket buffer size. Function returns -1 if it cannot be read
+ */
+static int socketBufferMax(const char *limitPath) {
+    std::ifstream file(limitPath);
+    int limit = -1;
+    if (!(file >> limit))
+        return -1;
+
+    return limit;
+}
+
+
+/*
+ * Helper function to set the size of a data socket buffer. Setting a size turns off the kernel autotuning
+ * of the buffer, and a size above the system limit is silently capped to it, leaving a buffer smaller
+ * than autotuning would grow. So a privileged process forces the size past the limit, and otherwise a
+ * size above the limit is skipped and the buffer left to autotuning
+ */
+static void setBufferSize(int sockfd, int option, int forceOption, const char *optionName, const char *limitPath, int value,
+                          std::ostream &log)
+{
+    if (value == 0 || setsockopt(sockfd, SOL_SOCKET, forceOption, &value, sizeof(value)) == 0)
+        return;
+
+    int limit = socketBufferMax(limitPath);
+    if (limit != -1 && value > limit) {
+        logDateTime(log) << "Skip " << optionName << " of " << value << " bytes above the system limit of "
+                         << limit << " bytes, the buffer is left to autotuning" << std::endl;
+        return;
+    }
+
+    setSocketOption(sockfd, SOL_SOCKET, option, optionName, value, log);
+}
+
+
+void SocketOptions::applyToCtrlSocket(int sockfd, std::ostream &log) const {
+    setSocketOption(sockfd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", ctrlNoDelay ? 1 : 0, log);
+}
+
+
+void SocketOptions::applyToDataSocket(int sockfd, std::ostream &log) const {
+    setBufferSize(sockfd, SO_RCVBUF, SO_RCVBUFFORCE, "SO_RCVBUF", RMEM_MAX_PATH, dataRecvBuffer, log);
+    setBufferSize(sockfd, SO_SNDBUF, SO_SNDBUFFORCE, "SO_SNDBUF", WMEM_MAX_PATH, dataSendBuffer, log);
+    setSocketOption(sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT", dataNotSentLowat, log);
+
+    if (!dataCongestion.empty() &&
+        setsockopt(sockfd, IPPROTO_TCP, TCP_CONGESTION, dataCongestion.c_str(), static_cast<socklen_t>(dataCongestion.size())) == -1)
+    {
+        logDateTime(log) << "Cannot set TCP_CONGESTION to " << dataCongestion << ": " << strerror(errno) << std::endl;
+    }
+}
+
+
+SocketOptions SocketOptions::lan() {
+    SocketOptions options;
+    options.profile          = "lan";
+    options.ctrlNoDelay      = true;
+    options.dataRecvBuffer   = 0;
+    options.dataSendBuffer   = 0;
+    options.dataCongestion   = "";
+    options.dataNotSentLowat = 0;
+    return options;
+}
+
+
+SocketOptions SocketOptions::wan() {
+    SocketOptions options;
+    options.profile          = "wan";
+    options.ctrlNoDelay      = true;
+    options.dataRecvBuffer   = 4 << 20;
+    options.dataSendBuffer   = 4 << 20;
+    options.dataCongestion   = "bbr";
+    options.dataNotSentLowat = 128 << 10;
+    return options;
+}
+
+
+SocketOptions SocketOptions::satellite() {
+    SocketOptions options;
+    options.profile          = "satellite";
+    options.ctrlNoDelay      = true;
+    options.dataRecvBuffer   = 32 << 20;
+    options.dataSendBuffer   = 32 << 20;
+    options.dataCongestion   = "hybla";
+    options.dataNotSentLowat = 512 << 10;
+    return options;
+}
+
+
+bool SocketOptions::fromProfile(const std::string &profile, SocketOptions &options) {
+    if (profile == "lan")
+        options = lan();
+    else if (profile == "wan")
+        options = wan();
+    else if (profile == "satellite")
+        options = satellite();
+    else
+        return false;
+
+    return true;
+}
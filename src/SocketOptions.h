@@ -0,0 +1,58 @@
+#ifndef SOCKETOPTIONS_H
+#define SOCKETOPTIONS_H
+
+#include <string>
+#include <ostream>
+
+
+/*
+ * SocketOptions struct
+ * Tuning of the sockets of a ftp connection for the path to the host. The control connection carries
+ * short commands, so it only turns off Nagle's algorithm. The data connection carries bulk transfers, so
+ * its buffers must hold the bandwidth-delay product of the path. A value of 0 or an empty congestion
+ * control keeps the system default. A buffer above the system limit of net.core.rmem_max or wmem_max is
+ * only set by a privileged process, otherwise it is left to the kernel autotuning
+ */
+struct SocketOptions {
+    std::string profile;
+    bool ctrlNoDelay;
+    int dataRecvBuffer;
+    int dataSendBuffer;
+    std::string dataCongestion;
+    int dataNotSentLowat;
+
+    /*
+     * Tune the socket of control connection. An option that the system refuses is logged, and the socket
+     * stays usable with its default
+     */
+    void applyToCtrlSocket(int sockfd, std::ostream &log) const;
+
+    /*
+     * Tune the socket of data connection. It must run before the socket connects or listens, since the
+     * window scale is chosen from the receive buffer size during the handshake. An option that the
+     * system refuses is logged, and the socket stays usable with its default
+     */
+    void applyToDataSocket(int sockfd, std::ostream &log) const;
+
+    /*
+     * Profile for hosts on the local network. Buffers are left to the kernel autotuning
+     */
+    static SocketOptions lan();
+
+    /*
+     * Profile for hosts across the internet, with tens of milliseconds of round trip
+     */
+    static SocketOptions wan();
+
+    /*
+     * Profile for links with a very high bandwidth-delay product, such as geostationary satellite
+     */
+    static SocketOptions satellite();
+
+    /*
+     * Get the profile by its name. Function returns false if there is no such profile
+     */
+    static bool fromProfile(const std::string &profile, SocketOptions &options);
+};
+
+#endif // SOCKETOPTIONS_H
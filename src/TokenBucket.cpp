@@ -0,0 +1,63 @@
+#include <thread>
+#include <algorithm>
+#include "TokenBucket.h"
+
+
+TokenBucket::TokenBucket()
+    : _rate{0}, _burst{0}, _tokens{0}, _last{std::chrono::steady_clock::now()}
+{}
+
+
+void TokenBucket::setRate(uint64_t rate, uint64_t burst) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _rate   = rate;
+    _burst  = rate == 0 ? 0 : (burst != 0 ? burst : rate);
+    _tokens = static_cast<double>(_burst);
+    _last   = std::chrono::steady_clock::now();
+}
+
+
+uint64_t TokenBucket::rate() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _rate;
+}
+
+
+uint64_t TokenBucket::burst() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _burst;
+}
+
+
+void TokenBucket::refill() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tokens = static_cast<double>(_burst);
+    _last   = std::chrono::steady_clock::now();
+}
+
+
+void TokenBucket::consume(size_t bytes) {
+    auto wait = take(bytes);
+    if (wait.count() > 0)
+        std::this_thread::sleep_for(wait);
+}
+
+
+std::chrono::nanoseconds TokenBucket::take(size_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_rate == 0)
+        return std::chrono::nanoseconds(0);
+
+    // add the tokens earned since the last call, upto the bucket size
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - _last;
+    _last   = now;
+    _tokens = std::min(static_cast<double>(_burst), _tokens + elapsed.count() * static_cast<double>(_rate));
+    _tokens -= static_cast<double>(bytes);
+
+    // the debt includes what the other threads took before, so they are served in turn
+    if (_tokens >= 0)
+        return std::chrono::nanoseconds(0);
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(-_tokens / static_cast<double>(_rate)));
+}
@@ -0,0 +1,66 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * TokenBucket class
+ * Limit the rate of bytes passed through it. The bucket fills at rate bytes per second up to burst bytes,
+ * and every byte consumed takes a token out. A caller that takes more than the bucket holds goes into
+ * debt and sleeps until the debt is paid, so the rate holds on average while bursts up to the bucket size
+ * go through at full speed. One bucket can be shared by many threads to cap their total rate. Callers that
+ * must not sleep, like the sessions of an event loop, take the tokens and wait on their own
+ */
+class TokenBucket {
+public:
+    TokenBucket();
+
+    TokenBucket(const TokenBucket &) = delete;
+
+    TokenBucket &operator=(const TokenBucket &) = delete;
+
+    /*
+     * Set the rate in bytes per second and the bucket size in bytes. Rate 0 turns off the limit. If burst
+     * is 0, the bucket holds one second of the rate. The bucket starts full
+     */
+    void setRate(uint64_t rate, uint64_t burst);
+
+    /*
+     * Get the rate in bytes per second. It is 0 if there is no limit
+     */
+    uint64_t rate() const;
+
+    /*
+     * Get the bucket size in bytes
+     */
+    uint64_t burst() const;
+
+    /*
+     * Fill the bucket up, so that the next transfer can start with a burst
+     */
+    void refill();
+
+    /*
+     * Take the tokens for the bytes, sleeping as long as the bucket is in debt
+     */
+    void consume(size_t bytes);
+
+    /*
+     * Take the tokens for the bytes without sleeping. Function returns how long the caller has to wait
+     * before it moves more bytes, which is 0 if the bucket is not in debt
+     */
+    std::chrono::nanoseconds take(size_t bytes);
+
+private:
+    mutable std::mutex _mutex;
+    uint64_t _rate;
+    uint64_t _burst;
+    double _tokens;
+    std::chrono::steady_clock::time_point _last;
+};
+
+#endif // TOKENBUCKET_H
@@ -0,0 +1,65 @@
+#include <fstream>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "TransferJournal.h"
+#include "Utility.h"
+
+
+const std::string TransferJournal::SUFFIX = ".ftpjournal";
+
+
+TransferJournal::TransferJournal(const std::string &localPath)
+    : _path{localPath + SUFFIX}
+{}
+
+
+const std::string &TransferJournal::path() const {
+    return _path;
+}
+
+
+bool TransferJournal::matches(const Entry &entry) const {
+    Entry recorded;
+    return load(recorded) &&
+           recorded.direction  == entry.direction  &&
+           recorded.remotePath == entry.remotePath &&
+           recorded.size       == entry.size       &&
+           recorded.version    == entry.version;
+}
+
+
+bool TransferJournal::load(Entry &entry) const {
+    std::ifstream journal(_path);
+    std::string size;
+    if (!std::getline(journal, entry.direction) || !std::getline(journal, entry.remotePath) ||
+        !std::getline(journal, size) || !std::getline(journal, entry.version))
+        return false;
+
+    return toUnsignedInt(size, entry.size) == 0;
+}
+
+
+bool TransferJournal::save(const Entry &entry) const {
+    std::string tmpPath = _path + ".tmp";
+    {
+        std::ofstream journal(tmpPath, std::ios::trunc);
+        journal << entry.direction << "\n" << entry.remotePath << "\n" << entry.size << "\n" << entry.version << "\n";
+        if (!journal.flush())
+            return false;
+    }
+
+    // make the journal durable before it replaces the old one
+    FileDescriptor file(open(tmpPath.c_str(), O_RDONLY | O_CLOEXEC));
+    if (file.get() == -1 || fsync(file.get()) == -1 || std::rename(tmpPath.c_str(), _path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+void TransferJournal::remove() const {
+    std::remove(_path.c_str());
+}
@@ -0,0 +1,62 @@
+#ifndef TRANSFERJOURNAL_H
+#define TRANSFERJOURNAL_H
+
+#include <string>
+#include <cstdint>
+
+
+/*
+ * TransferJournal class
+ * Record the get or put in progress in a file next to the local file, so that an interrupted transfer
+ * can be resumed by a later run of the program. The journal identifies the transfer; the bytes already
+ * at the destination are the checkpoint. The journal is removed once the transfer completes
+ */
+class TransferJournal {
+public:
+    /*
+     * Entry struct
+     * The transfer recorded in the journal. Version is the modification time of the source file,
+     * so that a source that changed since the interruption is transferred again from the start
+     */
+    struct Entry {
+        std::string direction;
+        std::string remotePath;
+        uint64_t size;
+        std::string version;
+    };
+
+    explicit TransferJournal(const std::string &localPath);
+
+    /*
+     * Get the path of the journal file
+     */
+    const std::string &path() const;
+
+    /*
+     * Check if the journal records the same transfer as the entry
+     */
+    bool matches(const Entry &entry) const;
+
+    /*
+     * Read the journal. Function returns false if there is no journal or it cannot be parsed
+     */
+    bool load(Entry &entry) const;
+
+    /*
+     * Write the journal through a temporary file, so that a crash never leaves half of a journal behind.
+     * Function returns false if the journal cannot be written
+     */
+    bool save(const Entry &entry) const;
+
+    /*
+     * Remove the journal
+     */
+    void remove() const;
+
+    static const std::string SUFFIX;
+
+private:
+    std::string _path;
+};
+
+#endif // TRANSFERJOURNAL_H
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include "TransferProgress.h"
+
+
+ProgressMeter::ProgressMeter()
+    : _interval{0}, _total{0}, _transferred{0}, _lastTransferred{0}
+{}
+
+
+void ProgressMeter::setCallback(ProgressCallback callback, std::chrono::milliseconds interval) {
+    _callback = std::move(callback);
+    _interval = interval;
+}
+
+
+void ProgressMeter::start(uint64_t total) {
+    _total           = total;
+    _transferred     = 0;
+    _lastTransferred = 0;
+    _start           = Clock::now();
+    _lastReport      = _start;
+}
+
+
+void ProgressMeter::add(size_t bytes) {
+    _transferred += bytes;
+    if (!_callback)
+        return;
+
+    auto now = Clock::now();
+    if (now - _lastReport >= _interval)
+        report(now, false);
+}
+
+
+void ProgressMeter::finish(uint64_t transferred) {
+    _transferred = std::max(_transferred, transferred);
+    if (_callback)
+        report(Clock::now(), true);
+}
+
+
+void ProgressMeter::report(Clock::time_point now, bool done) {
+    std::chrono::duration<double> sinceStart = now - _start;
+    std::chrono::duration<double> sinceLast  = now - _lastReport;
+
+    TransferProgress progress;
+    progress.transferred = _transferred;
+    progress.total       = _total;
+    progress.averageRate = sinceStart.count() > 0 ? static_cast<double>(_transferred) / sinceStart.count() : 0;
+    progress.currentRate = sinceLast.count() > 0 ? static_cast<double>(_transferred - _lastTransferred) / sinceLast.count() : 0;
+    progress.done        = done;
+
+    // the current rate follows a link that slows down or speeds up during a long transfer
+    if (done || (_total != 0 && _transferred >= _total))
+        progress.eta = 0;
+    else if (_total > _transferred && progress.currentRate > 0)
+        progress.eta = static_cast<double>(_total - _transferred) / progress.currentRate;
+    else
+        progress.eta = -1;
+
+    _lastTransferred = _transferred;
+    _lastReport      = now;
+    _callback(progress);
+}
@@ -0,0 +1,81 @@
+#ifndef TRANSFERPROGRESS_H
+#define TRANSFERPROGRESS_H
+
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * TransferProgress struct
+ * Snapshot of the data transfer in progress. Rates are in bytes per second: the current rate over the
+ * last report interval and the average rate since the transfer started. Total is 0 and eta is negative
+ * when the size of the transfer is not known
+ */
+struct TransferProgress {
+    uint64_t transferred;
+    uint64_t total;
+    double currentRate;
+    double averageRate;
+    double eta;
+    bool done;
+};
+
+
+/*
+ * ProgressCallback
+ * Receive the progress of the data transfer. It is called from the thread that runs the transfer
+ */
+using ProgressCallback = std::function<void(const TransferProgress &progress)>;
+
+
+/*
+ * ProgressMeter class
+ * Count the bytes of the data transfer and report its progress to the callback, at most once per
+ * interval plus once when the transfer is done. Counting a chunk without reporting only costs a
+ * clock read, so the meter can sit on the data path
+ */
+class ProgressMeter {
+public:
+    ProgressMeter();
+
+    /*
+     * Set the callback and the minimum interval between two reports. A null callback turns off reporting
+     */
+    void setCallback(ProgressCallback callback, std::chrono::milliseconds interval);
+
+    /*
+     * Start counting a new transfer of total bytes, or of unknown size if total is 0
+     */
+    void start(uint64_t total);
+
+    /*
+     * Count the bytes moved by the transfer and report if the interval is over
+     */
+    void add(size_t bytes);
+
+    /*
+     * Report the end of the transfer, whether it completed or failed. Transferred is the final byte count,
+     * which includes the bytes moved on paths that are not counted chunk by chunk
+     */
+    void finish(uint64_t transferred);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    /*
+     * Helper function to compute the rates and pass the progress to the callback
+     */
+    void report(Clock::time_point now, bool done);
+
+    ProgressCallback _callback;
+    std::chrono::milliseconds _interval;
+    uint64_t _total;
+    uint64_t _transferred;
+    uint64_t _lastTransferred;
+    Clock::time_point _start;
+    Clock::time_point _lastReport;
+};
+
+#endif // TRANSFERPROGRESS_H
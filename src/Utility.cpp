@@ -1,7 +1,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
 #include <iomanip>
 #include "Utility.h"
+#include "AsyncLog.h"
 
 
 std::vector<std::string> splitString(const std::string &str, const std::string &token) {
@@ -19,14 +22,129 @@ std::vector<std::string> splitString(const std::string &str, const std::string &
 }
 
 
+std::string trimString(const std::string &str) {
+    static const char *SPACES = " \t\r\n";
+    auto begin = str.find_first_not_of(SPACES);
+    if (begin == std::string::npos)
+        return "";
+
+    auto end = str.find_last_not_of(SPACES);
+    return str.substr(begin, end - begin + 1);
+}
+
+
 bool isRegularFile(const std::string &file) {
     struct stat fstat;
     return stat(file.c_str(), &fstat) == 0 && S_ISREG(fstat.st_mode);
 }
 
 
+off_t fileSizeOf(int fd) {
+    struct stat fstat;
+    if (::fstat(fd, &fstat) != 0)
+        return -1;
+
+    return fstat.st_size;
+}
+
+
+bool writeFileEnsure(int fd, const void *buf, size_t size) {
+    auto bytes = static_cast<const char *>(buf);
+    size_t writeSofar = 0;
+    while (writeSofar < size) {
+        auto wn = write(fd, bytes + writeSofar, size - writeSofar);
+        if (wn == -1 && errno == EINTR)
+            continue;
+
+        if (wn == -1)
+            return false;
+
+        writeSofar += static_cast<size_t>(wn);
+    }
+
+    return true;
+}
+
+
+FileDescriptor::FileDescriptor(int fd)
+    : _fd{fd}
+{}
+
+
+FileDescriptor::~FileDescriptor() {
+    if (_fd != -1)
+        close(_fd);
+}
+
+
+int FileDescriptor::get() const {
+    return _fd;
+}
+
+
+const std::string &logTimePrefix(std::time_t time) {
+    thread_local std::time_t cachedTime = 0;
+    thread_local std::string cachedPrefix;
+    if (time != cachedTime || cachedPrefix.empty()) {
+        std::tm tm;
+        localtime_r(&time, &tm);
+        std::ostringstream prefix;
+        prefix << std::put_time(&tm, "%c %Z") << ": ";
+        cachedPrefix = prefix.str();
+        cachedTime = time;
+    }
+
+    return cachedPrefix;
+}
+
+
 std::ostream &logDateTime(std::ostream &stream) {
     std::time_t now = std::time(nullptr);
-    std::tm tm = *std::localtime(&now);
-    return stream << std::put_time(&tm, "%c %Z") << ": ";
+    auto logStream = dynamic_cast<LogStream *>(&stream);
+    if (logStream) {
+        logStream->stamp(now);
+        return stream;
+    }
+
+    return stream << logTimePrefix(now);
+}
+
+
+LogStream::LogStream(AsyncLog *log)
+    : std::ostream{nullptr}, _buf{log}
+{
+    rdbuf(&_buf);
+}
+
+
+LogStream::~LogStream() {
+    _buf.pubsync();
+}
+
+
+void LogStream::stamp(std::time_t time) {
+    _buf.stamp(time);
+}
+
+
+LogStream::Buffer::Buffer(AsyncLog *log)
+    : _log{log}, _time{0}
+{}
+
+
+void LogStream::Buffer::stamp(std::time_t time) {
+    sync();
+    _time = time;
+}
+
+
+int LogStream::Buffer::sync() {
+    if (pptr() == pbase())
+        return 0;
+
+    // a full log drops the record instead of waiting, so the stream never fails
+    _log->push(_time, pbase(), static_cast<size_t>(pptr() - pbase()));
+    _time = 0;
+    str("");
+    return 0;
 }
@@ -5,17 +5,110 @@
 #include <vector>
 #include <limits>
 #include <iostream>
+#include <sstream>
+#include <ctime>
+#include <sys/types.h>
 
 
 bool isRegularFile(const std::string &file);
 
 
+/*
+ * Return the size of the opened file, or -1 if the size cannot be retrieved
+ */
+off_t fileSizeOf(int fd);
+
+
+/*
+ * Write size bytes of buffer to the file descriptor. Function returns false if the write fails
+ */
+bool writeFileEnsure(int fd, const void *buf, size_t size);
+
+
+/*
+ * FileDescriptor class
+ * Own a file descriptor and close it when going out of scope
+ */
+class FileDescriptor {
+public:
+    explicit FileDescriptor(int fd = -1);
+
+    FileDescriptor(const FileDescriptor &) = delete;
+
+    FileDescriptor &operator=(const FileDescriptor &) = delete;
+
+    ~FileDescriptor();
+
+    int get() const;
+
+private:
+    int _fd;
+};
+
+
+class AsyncLog;
+
+
+/*
+ * Return the time prefix of log records written in that second. The prefix is formatted once per
+ * second on each thread
+ */
+const std::string &logTimePrefix(std::time_t time);
+
+
+/*
+ * Start a log record with the current time. A LogStream only stamps the record with the time and
+ * leaves the formatting to its log, any other stream gets the time prefix written
+ */
 std::ostream &logDateTime(std::ostream &stream);
 
 
+/*
+ * LogStream class
+ * Output stream that collects what is written into it and pushes the text to the shared log as one
+ * record on every flush or new time stamp. Each thread should log through its own LogStream, and
+ * all of them can share the same log
+ */
+class LogStream : public std::ostream {
+public:
+    explicit LogStream(AsyncLog *log);
+
+    LogStream(const LogStream &) = delete;
+
+    LogStream &operator=(const LogStream &) = delete;
+
+    ~LogStream() override;
+
+    /*
+     * Push what is collected so far and start a new record stamped with the time
+     */
+    void stamp(std::time_t time);
+
+private:
+    class Buffer : public std::stringbuf {
+    public:
+        explicit Buffer(AsyncLog *log);
+
+        void stamp(std::time_t time);
+
+    protected:
+        int sync() override;
+
+    private:
+        AsyncLog *_log;
+        std::time_t _time;
+    };
+
+    Buffer _buf;
+};
+
+
 std::vector<std::string> splitString(const std::string &str, const std::string &token);
 
 
+std::string trimString(const std::string &str);
+
+
 template<typename Iter>
 std::string joinString(Iter begin, Iter end, const std::string &token) {
     std::string res;
@@ -60,5 +60,6 @@ int main(int argc, const char **argv) {
     CommandService cmdService(&std::cout, &std::cin, &logger, hostname, port);
     cmdService.run();
 
-    exit(0);
+    // return instead of exit, so that the command service writes out the rest of the log before the file closes
+    return 0;
 }
@@ -0,0 +1,94 @@
+#include <string>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "catch.hpp"
+#include "AsyncLog.h"
+#include "Utility.h"
+
+
+TEST_CASE("AsyncLog write records in order", "[AsyncLog]") {
+    std::ostringstream sink;
+    {
+        AsyncLog log(&sink, 64);
+        REQUIRE(log.push(0, "first\n", 6));
+        REQUIRE(log.push(0, "second\n", 7));
+    }
+
+    REQUIRE(sink.str() == "first\nsecond\n");
+}
+
+
+TEST_CASE("AsyncLog prefix stamped records with the time", "[AsyncLog]") {
+    // fixed times, so the records do not depend on the clock ticking over while they are logged
+    const std::time_t sentTime = 1700000000;
+    const std::time_t receivedTime = sentTime + 1;
+    std::ostringstream sink;
+    {
+        AsyncLog log(&sink, 64);
+        LogStream logger(&log);
+        logger.stamp(sentTime);
+        logger << "Sent NOOP\r\n";
+        logger.stamp(receivedTime);
+        logger << "Received 200 OK" << std::endl;
+    }
+
+    // the prefix is cached per thread, so each one is copied before the next is formatted
+    std::string sentPrefix = logTimePrefix(sentTime);
+    std::string receivedPrefix = logTimePrefix(receivedTime);
+    REQUIRE(sink.str() == sentPrefix + "Sent NOOP\r\n" + receivedPrefix + "Received 200 OK\n");
+}
+
+
+TEST_CASE("AsyncLog keep long records whole", "[AsyncLog]") {
+    std::ostringstream sink;
+    std::string longRecord(AsyncLog::SLOT_TEXT_SIZE * 5 + 7, 'x');
+    longRecord.back() = '\n';
+    {
+        AsyncLog log(&sink, 64);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&log, &longRecord]() {
+                for (int i = 0; i < 200; ++i) {
+                    while (!log.push(0, longRecord.data(), longRecord.size()))
+                        std::this_thread::yield();
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    // dropped records are reported in the log
+    auto lines = splitString(sink.str(), "\n");
+    size_t records = 0;
+    for (const auto &line : lines) {
+        if (line.find("Dropped") != std::string::npos || line.empty())
+            continue;
+
+        REQUIRE(line.size() == longRecord.size() - 1);
+        REQUIRE(line.find_first_not_of('x') == std::string::npos);
+        ++records;
+    }
+
+    REQUIRE(records == 4 * 200);
+}
+
+
+TEST_CASE("AsyncLog drop records when full", "[AsyncLog]") {
+    std::ostringstream sink;
+    std::string fullRecord(AsyncLog::SLOT_TEXT_SIZE * AsyncLog::MAX_RECORD_SLOTS, 'x');
+    size_t pushed = 0;
+    uint64_t dropped = 0;
+    {
+        AsyncLog log(&sink, AsyncLog::MAX_RECORD_SLOTS);
+        for (int i = 0; i < 100; ++i)
+            pushed += log.push(0, fullRecord.data(), fullRecord.size()) ? 1 : 0;
+
+        dropped = log.dropped();
+    }
+
+    REQUIRE(pushed + dropped == 100);
+    REQUIRE(sink.str().size() >= pushed * fullRecord.size());
+}
@@ -0,0 +1,334 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <zlib.h>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <vector>
+#include "catch.hpp"
+#include "FakeFtpServer.h"
+#include "Cmd.h"
+
+
+static std::string makeTempDir() {
+    char dir[] = "/tmp/ftp_client_test_XXXXXX";
+    return mkdtemp(dir) ? dir : "/tmp";
+}
+
+
+/*
+ * Remove the temporary directory with every file left in it
+ */
+static void removeTempDir(const std::string &dir) {
+    DIR *entries = opendir(dir.c_str());
+    if (entries == nullptr)
+        return;
+
+    while (dirent *entry = readdir(entries)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..")
+            unlink((dir + "/" + name).c_str());
+    }
+
+    closedir(entries);
+    rmdir(dir.c_str());
+}
+
+
+/*
+ * Data that is not all the same byte, so it takes several blocks and deflates to something smaller
+ */
+static std::string makeData(size_t size) {
+    std::string data(size, ' ');
+    for (size_t i = 0; i < size; ++i)
+        data[i] = static_cast<char>('a' + i * 7 % 23);
+
+    return data;
+}
+
+
+static std::string deflateData(const std::string &data) {
+    uLongf size = compressBound(data.size());
+    std::string deflated(size, '\0');
+    compress(reinterpret_cast<Bytef *>(&deflated[0]), &size, reinterpret_cast<const Bytef *>(data.data()), data.size());
+    deflated.resize(size);
+    return deflated;
+}
+
+
+static std::string inflateData(const std::string &deflated, size_t size) {
+    std::string data(size, '\0');
+    uLongf dataSize = size;
+    if (uncompress(reinterpret_cast<Bytef *>(&data[0]), &dataSize, reinterpret_cast<const Bytef *>(deflated.data()), deflated.size()) != Z_OK)
+        return "";
+
+    data.resize(dataSize);
+    return data;
+}
+
+
+static std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+
+/*
+ * Run the interactive session against the server with the commands, after logging in
+ */
+static std::string runSession(FakeFtpServer &server, const std::string &commands) {
+    std::ostringstream output, log;
+    std::istringstream input("user\npassword\n" + commands + "quit\n");
+    {
+        CommandService cmdService(&output, &input, &log, "127.0.0.1", server.port());
+        cmdService.run();
+    }
+
+    server.wait();
+    return output.str();
+}
+
+
+TEST_CASE("CommandService get twice over the data connection kept in block mode", "[CommandService]") {
+    std::string dir = makeTempDir();
+    FakeFtpServer server;
+    server.setFile("a.bin", blockFrame(0, "first ") + blockFrame(64, "file"));
+    server.setFile("b.bin", blockFrame(0, "second ") + blockFrame(16, "\x01\x02") + blockFrame(64, "file"));
+    server.start();
+
+    std::string output = runSession(server, "passive\nblock\nget a.bin " + dir + "/a.bin\nget b.bin " + dir + "/b.bin\n");
+
+    // the second RETR is answered with 125 on the kept connection
+    REQUIRE(output.find("125 ") != std::string::npos);
+    REQUIRE(server.dataConnections() == 1);
+    REQUIRE(readFile(dir + "/a.bin") == "first file");
+    REQUIRE(readFile(dir + "/b.bin") == "second file");
+    REQUIRE(server.commands().back() == "QUIT");
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService get keeps the local file when the download fails", "[CommandService]") {
+    std::string dir = makeTempDir();
+    std::string localPath = dir + "/local.txt";
+    std::ofstream(localPath) << "local data";
+
+    FakeFtpServer server;
+    server.setFile("remote.txt", "remote data");
+    server.start();
+
+    runSession(server, "passive\nget missing.txt " + localPath + "\nget remote.txt " + dir + "/remote.txt\n");
+
+    REQUIRE(readFile(localPath) == "local data");
+    REQUIRE(readFile(dir + "/remote.txt") == "remote data");
+    REQUIRE(access((localPath + ".part").c_str(), F_OK) == -1);
+    REQUIRE(access((dir + "/remote.txt.part").c_str(), F_OK) == -1);
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService get asks for the modification time only to resume", "[CommandService]") {
+    std::string dir = makeTempDir();
+    FakeFtpServer server;
+    server.setFile("a.bin", "remote data");
+    server.start();
+
+    // the fresh get has no journal to compare with, the get with -c compares the version it records
+    runSession(server, "passive\nget a.bin " + dir + "/a.bin\nget -c a.bin " + dir + "/b.bin\n");
+
+    const auto &commands = server.commands();
+    REQUIRE(std::count(commands.begin(), commands.end(), "MDTM a.bin") == 1);
+    REQUIRE(readFile(dir + "/a.bin") == "remote data");
+    REQUIRE(readFile(dir + "/b.bin") == "remote data");
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService logs in again into the same directory, type and mode", "[CommandService]") {
+    std::string dir = makeTempDir();
+    FakeFtpServer server;
+    server.setFile("a.bin", blockFrame(64, "block file"));
+    server.setReply("PWD", "");
+    server.start();
+
+    // the server drops the connection on PWD, so the get after it fails and the client logs in again
+    std::string output = runSession(server, "passive\ncd /pub\ncd data\nblock\nget a.bin " + dir + "/a.bin\npwd\n"
+                                            "get a.bin " + dir + "/lost.bin\nget a.bin " + dir + "/b.bin\n");
+    INFO(output);
+
+    const auto &commands = server.commands();
+    auto relogin = std::find(commands.begin() + 1, commands.end(), "USER user");
+    REQUIRE(relogin != commands.end());
+    REQUIRE(std::vector<std::string>(relogin, relogin + 6)
+            == std::vector<std::string>({"USER user", "PASS password", "CWD /pub", "CWD data", "TYPE I", "MODE B"}));
+    REQUIRE(readFile(dir + "/b.bin") == "block file");
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService mget sessions change to the remote directory of the interactive session", "[CommandService]") {
+    std::string dir = makeTempDir();
+    FakeFtpServer server;
+    server.setFile("a.bin", "first file");
+    server.setFile("b.bin", "second file");
+    server.setFile("c.bin", "third file");
+    server.start();
+
+    // mget downloads into the current local directory
+    char cwd[4096];
+    REQUIRE(getcwd(cwd, sizeof(cwd)) != nullptr);
+    REQUIRE(chdir(dir.c_str()) == 0);
+    std::string output = runSession(server, "passive\nmget -p 1 a.bin\ncd pub\nmget -p 1 b.bin\nmget -e c.bin\n");
+    REQUIRE(chdir(cwd) == 0);
+    INFO(output);
+
+    // the session opened before cd is not reused after it, and every session opened after cd changes to pub
+    const auto &commands = server.commands();
+    std::vector<size_t> logins;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        if (commands[i] == "USER user")
+            logins.push_back(i);
+    }
+    REQUIRE(logins.size() == 4);
+    for (size_t i = 2; i < logins.size(); ++i) {
+        REQUIRE(std::vector<std::string>(commands.begin() + logins[i], commands.begin() + logins[i] + 4)
+                == std::vector<std::string>({"USER user", "PASS password", "TYPE I", "CWD pub"}));
+    }
+    REQUIRE(readFile(dir + "/b.bin") == "second file");
+    REQUIRE(readFile(dir + "/c.bin") == "third file");
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService mget skips remote files with a local path already taken", "[CommandService]") {
+    std::string dir = makeTempDir();
+    FakeFtpServer server;
+    server.setFile("a/x.bin", "first file");
+    server.setFile("b/x.bin", "second file");
+    server.start();
+
+    char cwd[4096];
+    REQUIRE(getcwd(cwd, sizeof(cwd)) != nullptr);
+    REQUIRE(chdir(dir.c_str()) == 0);
+    std::string output = runSession(server, "passive\nmget -p 2 a/x.bin b/x.bin\n");
+    REQUIRE(chdir(cwd) == 0);
+    INFO(output);
+
+    const auto &commands = server.commands();
+    REQUIRE(output.find("Skip b/x.bin: local path x.bin is taken by a/x.bin") != std::string::npos);
+    REQUIRE(std::count(commands.begin(), commands.end(), "RETR b/x.bin") == 0);
+    REQUIRE(readFile(dir + "/x.bin") == "first file");
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService get in segments puts every range in place", "[CommandService]") {
+    std::string dir = makeTempDir();
+    std::string data = makeData(300000);
+    FakeFtpServer server;
+    server.setFile("big.bin", data);
+    server.start();
+
+    // every segment but the last stops at its length while the server still sends the rest of the file
+    std::string output = runSession(server, "passive\nget -s 3 big.bin " + dir + "/big.bin\n");
+    INFO(output);
+
+    const auto &commands = server.commands();
+    REQUIRE(std::count(commands.begin(), commands.end(), "REST 100000") == 1);
+    REQUIRE(std::count(commands.begin(), commands.end(), "REST 200000") == 1);
+    REQUIRE(std::count(commands.begin(), commands.end(), "RETR big.bin") == 3);
+    REQUIRE(output.find("Downloaded 300000 of 300000 bytes in 3 segments") != std::string::npos);
+    REQUIRE(readFile(dir + "/big.bin") == data);
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService put and get back in compressed mode", "[CommandService]") {
+    std::string dir = makeTempDir();
+    std::string data = makeData(300000);
+    std::ofstream(dir + "/up.bin", std::ios::binary) << data;
+
+    FakeFtpServer server;
+    server.setReply("FEAT", "211-Features:\r\n MODE Z\r\n211 End\r\n");
+    server.start();
+
+    runSession(server, "passive\ncompress\nput " + dir + "/up.bin up.bin\nget up.bin " + dir + "/down.bin\n");
+
+    // the server stores the deflated stream as received and sends it back as is
+    auto stored = server.files().find("up.bin");
+    REQUIRE(stored != server.files().end());
+    REQUIRE(stored->second.size() < data.size());
+    REQUIRE(inflateData(stored->second, data.size()) == data);
+    REQUIRE(readFile(dir + "/down.bin") == data);
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService get fails on a deflate stream cut short", "[CommandService]") {
+    std::string dir = makeTempDir();
+    std::string deflated = deflateData(makeData(300000));
+
+    FakeFtpServer server;
+    server.setReply("FEAT", "211-Features:\r\n MODE Z\r\n211 End\r\n");
+    server.setFile("cut.bin", deflated.substr(0, deflated.size() / 2));
+    server.start();
+
+    std::string output = runSession(server, "passive\ncompress\nget cut.bin " + dir + "/cut.bin\n");
+
+    REQUIRE(output.find(strerror(EPROTO)) != std::string::npos);
+    REQUIRE(access((dir + "/cut.bin").c_str(), F_OK) == -1);
+
+    removeTempDir(dir);
+}
+
+
+TEST_CASE("CommandService put and get back in block mode", "[CommandService]") {
+    std::string dir = makeTempDir();
+    std::string data = makeData(200000);
+    std::ofstream(dir + "/up.bin", std::ios::binary) << data;
+
+    FakeFtpServer server;
+    server.setFile("marked.bin", blockFrame(0, "before ") + blockFrame(16, "\x00\x01\x02\x03") + blockFrame(0, "after")
+                                 + blockFrame(64, ""));
+    server.start();
+
+    runSession(server, "passive\nblock\nput " + dir + "/up.bin up.bin\nget up.bin " + dir + "/down.bin\n"
+                       "get marked.bin " + dir + "/marked.bin\n");
+
+    // every block is at most 65535 bytes, and the file ends with an empty EOF block
+    auto stored = server.files().find("up.bin");
+    REQUIRE(stored != server.files().end());
+    const std::string &frames = stored->second;
+    std::string framed;
+    size_t pos = 0;
+    unsigned char descriptor = 0;
+    while (pos + 3 <= frames.size() && !(descriptor & 64)) {
+        descriptor = static_cast<unsigned char>(frames[pos]);
+        size_t count = static_cast<size_t>(static_cast<unsigned char>(frames[pos + 1])) << 8 | static_cast<unsigned char>(frames[pos + 2]);
+        framed += frames.substr(pos + 3, count);
+        pos += 3 + count;
+    }
+    REQUIRE(descriptor == 64);
+    REQUIRE(pos == frames.size());
+    REQUIRE(framed == data);
+
+    // the blocks are sent back as stored, and the restart marker is not part of the file
+    REQUIRE(readFile(dir + "/down.bin") == data);
+    REQUIRE(readFile(dir + "/marked.bin") == "before after");
+    REQUIRE(server.dataConnections() == 1);
+
+    removeTempDir(dir);
+}
@@ -0,0 +1,49 @@
+#include <sstream>
+#include <string>
+#include "catch.hpp"
+#include "FakeFtpServer.h"
+#include "CoFtpService.h"
+
+
+TEST_CASE("CoFtpService retrieve a file with runBlocking", "[CoFtpService]") {
+    FakeFtpServer server;
+    server.setFile("a.bin", "coroutine data");
+    server.start();
+
+    std::ostringstream log;
+    EventLoop loop;
+    CoFtpService ftp(loop, &log);
+    TransferProgress last{};
+    ftp.setProgressCallback([&last](const TransferProgress &progress) { last = progress; }, std::chrono::milliseconds(0));
+
+    REQUIRE(runBlocking(loop, ftp.connect("127.0.0.1", server.port())).code == SERVICE_READY);
+    REQUIRE(runBlocking(loop, ftp.login("user", "password")));
+
+    std::string data;
+    REQUIRE(runBlocking(loop, ftp.retr("a.bin", [&data](const Byte *buf, size_t size) {
+        data.append(reinterpret_cast<const char *>(buf), size);
+        return true;
+    })));
+    REQUIRE(data == "coroutine data");
+    REQUIRE(last.done);
+    REQUIRE(last.transferred == data.size());
+
+    runBlocking(loop, ftp.quit());
+    server.wait();
+    REQUIRE(server.commands().back() == "QUIT");
+    REQUIRE(loop.size() == 0);
+    REQUIRE(loop.timerCount() == 0);
+}
+
+
+TEST_CASE("CoFtpService time out waiting for the greeting", "[CoFtpService]") {
+    // the connection is taken into the backlog of the listener, but no greeting ever comes
+    LoopbackListener listener;
+    std::ostringstream log;
+    EventLoop loop;
+    CoFtpService ftp(loop, &log);
+    ftp.setTimeouts({std::chrono::milliseconds(1000), std::chrono::milliseconds(0), std::chrono::milliseconds(100),
+                     std::chrono::milliseconds(0)});
+
+    REQUIRE_THROWS_WITH(runBlocking(loop, ftp.connect("127.0.0.1", listener.port())), TimeoutException("reading socket").what());
+}
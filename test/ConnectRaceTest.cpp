@@ -0,0 +1,66 @@
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "catch.hpp"
+#include "FakeFtpServer.h"
+#include "ConnectRace.h"
+#include "FtpService.h"
+
+
+static SocketAddress loopbackAddress(uint16_t port) {
+    SocketAddress address;
+    memset(&address.first, 0, sizeof(address.first));
+    auto &addr = reinterpret_cast<sockaddr_in &>(address.first);
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(port);
+    address.second = sizeof(addr);
+    return address;
+}
+
+
+TEST_CASE("resolveHost report the getaddrinfo error", "[ConnectRace]") {
+    try {
+        resolveHost("127.0.0.1", "no-such-service");
+        FAIL("resolveHost did not throw");
+    } catch (const ResolveException &e) {
+        REQUIRE(e.status() == EAI_SERVICE);
+        REQUIRE(std::string(e.what()) == gai_strerror(EAI_SERVICE));
+    }
+}
+
+
+TEST_CASE("ConnectRace skip a refused address", "[ConnectRace]") {
+    // a port that was just free refuses the connect, so the next address starts without the attempt delay
+    uint16_t refusedPort;
+    {
+        LoopbackListener closed;
+        refusedPort = closed.port();
+    }
+    LoopbackListener listener;
+
+    ConnectRace race({loopbackAddress(refusedPort), loopbackAddress(listener.port())}, std::chrono::seconds(10), nullptr);
+    size_t winner;
+    int sockfd = race.run(std::chrono::seconds(5), winner);
+    REQUIRE(winner == 1);
+    close(sockfd);
+}
+
+
+TEST_CASE("ConnectRace fail with the error of the last attempt", "[ConnectRace]") {
+    uint16_t refusedPort;
+    {
+        LoopbackListener closed;
+        refusedPort = closed.port();
+    }
+
+    ConnectRace race({loopbackAddress(refusedPort)}, std::chrono::milliseconds(250), nullptr);
+    size_t winner;
+    REQUIRE_THROWS_AS(race.run(std::chrono::seconds(5), winner), SocketException);
+    REQUIRE(race.failed());
+    REQUIRE(race.lastError() == ECONNREFUSED);
+}
@@ -0,0 +1,486 @@
+#ifndef FAKEFTPSERVER_H
+#define FAKEFTPSERVER_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+
+/*
+ * LoopbackListener class
+ * Listening socket on 127.0.0.1 with a port chosen by the system. Accepted sockets time out after a few
+ * seconds, so a test whose client goes wrong fails instead of hanging
+ */
+class LoopbackListener {
+public:
+    LoopbackListener() {
+        _fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        bind(_fd, reinterpret_cast<sockaddr *>(&addr), len);
+        listen(_fd, 16);
+        getsockname(_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+        _port = ntohs(addr.sin_port);
+    }
+
+    LoopbackListener(const LoopbackListener &) = delete;
+
+    LoopbackListener &operator=(const LoopbackListener &) = delete;
+
+    ~LoopbackListener() {
+        close(_fd);
+    }
+
+    uint16_t port() const {
+        return _port;
+    }
+
+    /*
+     * Accept the next connection. Function returns -1 if no client connects in time
+     */
+    int accept() {
+        timeval timeout{5, 0};
+        setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int fd = ::accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd != -1) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+
+        return fd;
+    }
+
+    /*
+     * Stop listening, so an accept waiting for a client returns -1 at once
+     */
+    void shutdown() {
+        ::shutdown(_fd, SHUT_RDWR);
+    }
+
+private:
+    int _fd;
+    uint16_t _port;
+};
+
+
+/*
+ * Read one CRLF terminated line from the socket, without the CRLF. Function returns false on EOF
+ */
+inline bool readLine(int fd, std::string &line) {
+    line.clear();
+    char c;
+    while (recv(fd, &c, 1, 0) == 1) {
+        if (c == '\n') {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            return true;
+        }
+
+        line += c;
+    }
+
+    return false;
+}
+
+
+/*
+ * Read exactly size bytes from the socket. Function returns false on EOF
+ */
+inline bool readExactly(int fd, std::string &data, size_t size) {
+    data.resize(size);
+    size_t readSofar = 0;
+    while (readSofar < size) {
+        auto rn = recv(fd, &data[readSofar], size - readSofar, 0);
+        if (rn <= 0)
+            return false;
+
+        readSofar += static_cast<size_t>(rn);
+    }
+
+    return true;
+}
+
+
+inline void writeAll(int fd, const std::string &data) {
+    size_t writeSofar = 0;
+    while (writeSofar < data.size()) {
+        auto wn = send(fd, data.data() + writeSofar, data.size() - writeSofar, MSG_NOSIGNAL);
+        if (wn <= 0)
+            return;
+
+        writeSofar += static_cast<size_t>(wn);
+    }
+}
+
+
+/*
+ * Frame the data as one MODE B block with the descriptor
+ */
+inline std::string blockFrame(unsigned char descriptor, const std::string &data) {
+    std::string frame;
+    frame += static_cast<char>(descriptor);
+    frame += static_cast<char>(data.size() >> 8 & 0xff);
+    frame += static_cast<char>(data.size() & 0xff);
+    return frame + data;
+}
+
+
+/*
+ * FakeFtpServer class
+ * Plays the server side of control connections, each on its own thread, until the client quits on its
+ * last open connection: login, CWD, TYPE, MODE, PASV, EPSV, SIZE, REST, RETR, STOR and QUIT. Files are sent exactly as given, so a test in MODE B or MODE Z passes data
+ * that is already framed or compressed, and stored files keep the bytes as received. REST makes the next
+ * RETR start at that offset of the file. In MODE B the data
+ * connection stays open after a transfer, and a transfer on it is started with 125 instead of 150.
+ * Commands are read in batches of what the client has already sent, so a pipelined batch is read whole
+ * before its first reply. A command with a scripted reply gets that reply once instead; a scripted 421 closes the connection, and
+ * so does an empty scripted reply without any reply, like a server that goes away. The commands of
+ * concurrent connections are recorded in the order they arrive.
+ * Everything the server saw must only be read after wait
+ */
+class FakeFtpServer {
+public:
+    FakeFtpServer() = default;
+
+    ~FakeFtpServer() {
+        wait();
+    }
+
+    uint16_t port() const {
+        return _ctrl.port();
+    }
+
+    void setFile(const std::string &name, const std::string &data) {
+        _files[name] = data;
+    }
+
+    void setReply(const std::string &cmd, const std::string &reply) {
+        _replies[cmd] = reply;
+    }
+
+    void start() {
+        _thread = std::thread(&FakeFtpServer::serve, this);
+    }
+
+    /*
+     * Wait until the client quits, or closes every control connection and does not connect again
+     */
+    void wait() {
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    const std::vector<std::string> &commands() const {
+        return _commands;
+    }
+
+    const std::map<std::string, std::string> &files() const {
+        return _files;
+    }
+
+    /*
+     * Number of data connections accepted
+     */
+    size_t dataConnections() const {
+        return _dataConnections;
+    }
+
+    /*
+     * Largest number of commands read in one batch, before the first of them was answered
+     */
+    size_t pipelinedMax() const {
+        return _pipelinedMax;
+    }
+
+private:
+    /*
+     * State of one control connection
+     */
+    struct Connection {
+        int fd;
+        std::unique_ptr<LoopbackListener> data;
+        int dataFd = -1;
+        char mode  = 'S';
+        size_t restOffset = 0;
+    };
+
+
+    void serve() {
+        std::vector<std::thread> connections;
+        int fd;
+        while ((fd = _ctrl.accept()) != -1) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_open;
+            connections.emplace_back([this, fd]() {
+                Connection conn;
+                conn.fd = fd;
+                bool quit = serveConnection(conn);
+                closeData(conn);
+                close(fd);
+
+                // the client is done once it quits on the last connection it has open
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!quit)
+                    --_open;
+                else if (_open == 0)
+                    _ctrl.shutdown();
+            });
+        }
+
+        for (auto &connection : connections)
+            connection.join();
+    }
+
+
+    enum Outcome {
+        SERVE,
+        CLOSE,
+        QUIT,
+    };
+
+
+    /*
+     * Serve one control connection. Function returns true if the client quits
+     */
+    bool serveConnection(Connection &conn) {
+        writeAll(conn.fd, "220 Fake FTP server ready\r\n");
+        std::vector<std::string> lines;
+        while (readCommands(conn.fd, lines)) {
+            for (const auto &line : lines) {
+                Outcome outcome = serveCommand(conn, line);
+                if (outcome != SERVE)
+                    return outcome == QUIT;
+            }
+        }
+
+        return false;
+    }
+
+
+    /*
+     * Read the next command and every command after it that the client has already sent.
+     * Function returns false on EOF
+     */
+    bool readCommands(int fd, std::vector<std::string> &lines) {
+        lines.clear();
+        std::string line;
+        if (!readLine(fd, line))
+            return false;
+
+        lines.push_back(line);
+        pollfd pfd{fd, POLLIN, 0};
+        while (poll(&pfd, 1, 0) == 1 && readLine(fd, line))
+            lines.push_back(line);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pipelinedMax = std::max(_pipelinedMax, lines.size());
+        return true;
+    }
+
+
+    Outcome serveCommand(Connection &conn, const std::string &line) {
+        int fd = conn.fd;
+        std::string verb = line.substr(0, line.find(' '));
+        std::string arg  = line.size() > verb.size() ? line.substr(verb.size() + 1) : "";
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _commands.push_back(line);
+        auto scripted = _replies.find(line);
+        if (scripted != _replies.end()) {
+            std::string reply = scripted->second;
+            _replies.erase(scripted);
+            lock.unlock();
+            writeAll(fd, reply);
+            if (reply.empty() || reply.compare(0, 3, "421") == 0)
+                return CLOSE;
+
+            return SERVE;
+        }
+
+        // the connection no longer counts as open before the client sees the reply to its QUIT
+        if (verb == "QUIT")
+            --_open;
+        lock.unlock();
+
+        if (verb == "USER")
+            writeAll(fd, "331 Password required\r\n");
+        else if (verb == "PASS")
+            writeAll(fd, "230 Logged in\r\n");
+        else if (verb == "CWD")
+            writeAll(fd, "250 Directory changed\r\n");
+        else if (verb == "TYPE")
+            writeAll(fd, "200 Type set\r\n");
+        else if (verb == "MODE") {
+            conn.mode = arg.empty() ? 'S' : arg[0];
+            closeData(conn);
+            writeAll(fd, "200 Mode set\r\n");
+        }
+        else if (verb == "PASV") {
+            uint16_t port = listenData(conn);
+            writeAll(fd, "227 Entering Passive Mode (127,0,0,1," + std::to_string(port >> 8) + "," + std::to_string(port & 0xff) + ").\r\n");
+        }
+        else if (verb == "EPSV")
+            writeAll(fd, "229 Entering Extended Passive Mode (|||" + std::to_string(listenData(conn)) + "|)\r\n");
+        else if (verb == "SIZE") {
+            std::string data;
+            writeAll(fd, !findFile(arg, data) ? "550 No such file\r\n" : "213 " + std::to_string(data.size()) + "\r\n");
+        }
+        else if (verb == "REST") {
+            conn.restOffset = std::stoul(arg);
+            writeAll(fd, "350 Restarting at " + arg + "\r\n");
+        }
+        else if (verb == "RETR")
+            retrieve(conn, arg);
+        else if (verb == "STOR")
+            store(conn, arg);
+        else if (verb == "QUIT") {
+            writeAll(fd, "221 Bye\r\n");
+            return QUIT;
+        }
+        else
+            writeAll(fd, "502 Command not implemented\r\n");
+
+        return SERVE;
+    }
+
+
+    /*
+     * Copy the file out of the shared files. Function returns false if there is no such file
+     */
+    bool findFile(const std::string &name, std::string &data) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto file = _files.find(name);
+        if (file == _files.end())
+            return false;
+
+        data = file->second;
+        return true;
+    }
+
+
+    /*
+     * Listen for the next data connection on a new port, like a server does on every PASV, so a connection
+     * left over from a refused transfer is never taken for the next one
+     */
+    uint16_t listenData(Connection &conn) {
+        conn.data = std::make_unique<LoopbackListener>();
+        return conn.data->port();
+    }
+
+
+    /*
+     * Accept the data connection, or start the transfer on the one kept open in MODE B
+     */
+    bool openData(Connection &conn) {
+        if (conn.dataFd != -1) {
+            writeAll(conn.fd, "125 Data connection already open; transfer starting\r\n");
+            return true;
+        }
+
+        conn.dataFd = conn.data ? conn.data->accept() : -1;
+        if (conn.dataFd == -1) {
+            writeAll(conn.fd, "425 Cannot open data connection\r\n");
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_dataConnections;
+        }
+        writeAll(conn.fd, "150 Opening data connection\r\n");
+        return true;
+    }
+
+
+    void closeData(Connection &conn) {
+        if (conn.dataFd == -1)
+            return;
+
+        close(conn.dataFd);
+        conn.dataFd = -1;
+    }
+
+
+    void retrieve(Connection &conn, const std::string &name) {
+        size_t offset = conn.restOffset;
+        conn.restOffset = 0;
+        std::string data;
+        if (!findFile(name, data)) {
+            writeAll(conn.fd, "550 No such file\r\n");
+            return;
+        }
+
+        if (!openData(conn))
+            return;
+
+        writeAll(conn.dataFd, data.substr(std::min(offset, data.size())));
+        if (conn.mode != 'B')
+            closeData(conn);
+
+        writeAll(conn.fd, "226 Transfer complete\r\n");
+    }
+
+
+    void store(Connection &conn, const std::string &name) {
+        if (!openData(conn))
+            return;
+
+        // in MODE B the end of file is the EOF block, otherwise the client closes the connection
+        std::string data, block;
+        if (conn.mode == 'B') {
+            unsigned char descriptor = 0;
+            while (!(descriptor & 64)) {
+                std::string header;
+                if (!readExactly(conn.dataFd, header, 3))
+                    break;
+
+                descriptor = static_cast<unsigned char>(header[0]);
+                size_t count = static_cast<size_t>(static_cast<unsigned char>(header[1])) << 8 | static_cast<unsigned char>(header[2]);
+                if (!readExactly(conn.dataFd, block, count))
+                    break;
+
+                data += header + block;
+            }
+        }
+        else {
+            char buf[4096];
+            ssize_t rn;
+            while ((rn = recv(conn.dataFd, buf, sizeof(buf), 0)) > 0)
+                data.append(buf, static_cast<size_t>(rn));
+            closeData(conn);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _files[name] = data;
+        }
+        writeAll(conn.fd, "226 Transfer complete\r\n");
+    }
+
+
+    LoopbackListener _ctrl;
+    size_t _open = 0;
+    size_t _dataConnections = 0;
+    size_t _pipelinedMax = 0;
+    std::map<std::string, std::string> _files;
+    std::map<std::string, std::string> _replies;
+    std::vector<std::string> _commands;
+    std::mutex _mutex;
+    std::thread _thread;
+};
+
+#endif // FAKEFTPSERVER_H
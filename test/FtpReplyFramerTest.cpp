@@ -0,0 +1,85 @@
+#include <string>
+#include "catch.hpp"
+#include "FtpReplyFramer.h"
+
+
+static void feed(FtpReplyFramer &framer, const std::string &bytes) {
+    size_t available;
+    char *buf = framer.prepare(bytes.size(), available);
+    std::copy(bytes.begin(), bytes.end(), buf);
+    framer.commit(bytes.size());
+}
+
+
+static std::string text(const FtpReplyFramer &framer) {
+    FtpReplyLine reply = framer.text();
+    return std::string(reply.data, reply.size);
+}
+
+
+TEST_CASE("FtpReplyFramer frame single line reply", "[FtpReplyFramer]") {
+    FtpReplyFramer framer;
+    feed(framer, "220 Welcome to CS472 FTP Server\r\n");
+    REQUIRE(framer.next());
+    REQUIRE(framer.code() == SERVICE_READY);
+    REQUIRE(framer.replyClass() == POSITIVE_COMPLETION);
+    REQUIRE(framer.lines().size() == 1);
+    REQUIRE(text(framer) == "220 Welcome to CS472 FTP Server\r\n");
+    REQUIRE_FALSE(framer.next());
+}
+
+
+TEST_CASE("FtpReplyFramer frame multi-line reply", "[FtpReplyFramer]") {
+    SECTION("reply received at once") {
+        FtpReplyFramer framer;
+        feed(framer, "211-Features:\r\n MDTM\r\n211-not the end\r\n SIZE\r\n211 End\r\n");
+        REQUIRE(framer.next());
+        REQUIRE(framer.code() == SYSTEM_STATUS);
+        REQUIRE(framer.lines().size() == 5);
+        REQUIRE(std::string(framer.lines()[1].data, framer.lines()[1].size) == " MDTM\r\n");
+        REQUIRE(std::string(framer.lines()[4].data, framer.lines()[4].size) == "211 End\r\n");
+    }
+
+    SECTION("reply split across reads") {
+        FtpReplyFramer framer;
+        feed(framer, "230-Welcome\r\n230-Line");
+        REQUIRE_FALSE(framer.next());
+        feed(framer, " two\r\n123 not the end\r\n");
+        REQUIRE_FALSE(framer.next());
+        feed(framer, "230 Login successful.\r\n");
+        REQUIRE(framer.next());
+        REQUIRE(framer.code() == USER_LOGGED_IN_PROCCEED);
+        REQUIRE(framer.lines().size() == 4);
+        REQUIRE(text(framer) == "230-Welcome\r\n230-Line two\r\n123 not the end\r\n230 Login successful.\r\n");
+    }
+}
+
+
+TEST_CASE("FtpReplyFramer frame pipelined replies", "[FtpReplyFramer]") {
+    FtpReplyFramer framer;
+    feed(framer, "150 Opening data connection\r\n226-Transfer complete\r\n226 Bye\r\n213 1024\r\n");
+    REQUIRE(framer.next());
+    REQUIRE(framer.code() == FILE_STATUS_OK_OPEN_DATA_CONNECTION);
+    REQUIRE(framer.replyClass() == POSITIVE_PRELIMINARY);
+    REQUIRE(framer.next());
+    REQUIRE(framer.code() == CLOSE_DATA_CONNECTION_REQUEST_FILE_ACTION_SUCCESS);
+    REQUIRE(framer.lines().size() == 2);
+    REQUIRE(framer.next());
+    REQUIRE(framer.code() == FILE_STATUS);
+    REQUIRE(text(framer) == "213 1024\r\n");
+    REQUIRE_FALSE(framer.next());
+}
+
+
+TEST_CASE("FtpReplyFramer keep partial reply", "[FtpReplyFramer]") {
+    FtpReplyFramer framer;
+    feed(framer, "221 Goodbye.\r\n421 Service");
+    REQUIRE(framer.next());
+    REQUIRE_FALSE(framer.next());
+
+    std::string remaining;
+    framer.takeRemaining(remaining);
+    REQUIRE(remaining == "421 Service");
+    REQUIRE(FtpReplyFramer::replyClassOf(SERVICE_UNAVAILABLE) == TRANSIENT_NEGATIVE_COMPLETION);
+    REQUIRE(FtpReplyFramer::replyClassOf(42) == INVALID_REPLY);
+}
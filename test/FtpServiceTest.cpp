@@ -1,6 +1,256 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
 #include "catch.hpp"
+#include "FakeFtpServer.h"
 #include "FtpService.h"
+#include "AsyncFtpSession.h"
+
+
+/*
+ * Open the control connection to the server and log in
+ */
+static void loginFakeServer(FtpService &ftpService, const FakeFtpServer &server) {
+    FtpCtrlReply reply;
+    ftpService.openCtrlConnect("127.0.0.1", server.port());
+    ftpService.readCtrlReply(reply);
+    REQUIRE(reply.code == SERVICE_READY);
+
+    ftpService.sendUSER("user");
+    ftpService.readCtrlReply(reply);
+    ftpService.sendPASS("password");
+    ftpService.readCtrlReply(reply);
+    REQUIRE(reply.code == USER_LOGGED_IN_PROCCEED);
+}
+
+
+/*
+ * Log out of the server and close the control connection
+ */
+static void quitFakeServer(FtpService &ftpService) {
+    FtpCtrlReply reply;
+    ftpService.sendQUIT();
+    ftpService.readCtrlReply(reply);
+    ftpService.closeCtrlConnect();
+}
+
+
+TEST_CASE("FtpService pipeline SIZE commands within the window", "[FtpService]") {
+    FakeFtpServer server;
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < 150; ++i) {
+        paths.push_back("file" + std::to_string(i));
+        if (i % 3 == 0)
+            server.setFile(paths.back(), std::string(i, 'x'));
+    }
+    server.start();
+
+    std::ostringstream log;
+    FtpService ftpService(&log);
+    loginFakeServer(ftpService, server);
+
+    std::vector<FtpCtrlReply> replies;
+    ftpService.sendPipelinedSIZE(paths, replies);
+    REQUIRE(replies.size() == paths.size());
+    for (size_t i = 0; i < replies.size(); ++i) {
+        if (i % 3 == 0)
+            REQUIRE(replies[i].msg == "213 " + std::to_string(i) + "\r\n");
+        else
+            REQUIRE(replies[i].code == REQUESTED_FILE_ACTION_NOT_TAKEN_FILE_UNAVAILABLE);
+    }
+
+    quitFakeServer(ftpService);
+    server.wait();
+
+    // the window is refilled before it drains, and never holds more than its size
+    const auto &commands = server.commands();
+    size_t window = FtpService::PIPELINE_WINDOW;
+    REQUIRE(std::count_if(commands.begin(), commands.end(), [](const std::string &cmd) { return cmd.compare(0, 5, "SIZE ") == 0; }) == 150);
+    REQUIRE(server.pipelinedMax() > 1);
+    REQUIRE(server.pipelinedMax() <= window);
+}
+
+
+TEST_CASE("FtpService pipelining stops at 421 reply", "[FtpService]") {
+    FakeFtpServer server;
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < 10; ++i) {
+        paths.push_back("file" + std::to_string(i));
+        server.setFile(paths.back(), "data");
+    }
+    server.setReply("SIZE file4", "421 Service not available, closing control connection\r\n");
+    server.start();
+
+    std::ostringstream log;
+    FtpService ftpService(&log);
+    loginFakeServer(ftpService, server);
+
+    std::vector<FtpCtrlReply> replies;
+    ftpService.sendPipelinedSIZE(paths, replies);
+    REQUIRE(replies.size() == 5);
+    for (size_t i = 0; i < 4; ++i)
+        REQUIRE(replies[i].code == FILE_STATUS);
+    REQUIRE(replies[4].code == SERVICE_UNAVAILABLE);
+    ftpService.closeCtrlConnect();
+
+    // the server takes a new connection after closing the old one
+    FtpCtrlReply reply;
+    ftpService.openCtrlConnect("127.0.0.1", server.port());
+    ftpService.readCtrlReply(reply);
+    REQUIRE(reply.code == SERVICE_READY);
+    quitFakeServer(ftpService);
+}
+
+
+TEST_CASE("FtpService keeps listening sockets within a one port range", "[FtpService]") {
+    // a port the system hands out is free once its listener closes
+    uint16_t portMin;
+    {
+        LoopbackListener listener;
+        portMin = listener.port();
+    }
+
+    std::ostringstream log;
+    FtpService ftpService(&log);
+    ftpService.setKeepListener(true);
+    ftpService.setActivePortRange(portMin, portMin);
+
+    // every transfer after the first takes the one kept listening socket instead of binding its port again
+    for (int i = 0; i < 3; ++i) {
+        uint16_t port = 0;
+        ftpService.openActiveDataConnect(port);
+        REQUIRE(port == portMin);
+        ftpService.closeDataConnect();
+    }
+}
+
+
+/*
+ * Retrieve the file over a passive data connection in the transfer mode, with its size as the expected size.
+ * Function returns the progress reports of the transfer
+ */
+static std::vector<TransferProgress> retrieveWithProgress(FtpService &ftpService, TransferMode mode, const std::string &name, size_t size) {
+    std::vector<TransferProgress> reports;
+    ftpService.setProgressCallback([&reports](const TransferProgress &progress) { reports.push_back(progress); },
+                                   std::chrono::milliseconds(0));
+
+    FtpCtrlReply reply;
+    ftpService.sendMODE(mode);
+    ftpService.readCtrlReply(reply);
+    ftpService.setTransferMode(mode);
+
+    ftpService.sendPASV();
+    ftpService.readCtrlReply(reply);
+    std::string ipAddr;
+    uint16_t port;
+    FtpService::parsePASVReply(reply.msg, ipAddr, port);
+    ftpService.openPassiveDataConnect(ipAddr, port);
+
+    ftpService.setExpectedTransferSize(size);
+    ftpService.sendRETR(name);
+    ftpService.readCtrlReply(reply);
+    std::vector<Byte> data;
+    ftpService.readDataReply(data);
+    ftpService.closeDataConnect();
+    ftpService.readCtrlReply(reply);
+    REQUIRE(data.size() == size);
+    return reports;
+}
+
+
+TEST_CASE("FtpService counts the progress in bytes of the file in compressed and block mode", "[FtpService]") {
+    std::string data(100000, ' ');
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>('a' + i * 7 % 23);
+
+    uLongf size = compressBound(data.size());
+    std::string deflated(size, '\0');
+    compress(reinterpret_cast<Bytef *>(&deflated[0]), &size, reinterpret_cast<const Bytef *>(data.data()), data.size());
+    deflated.resize(size);
+
+    FakeFtpServer server;
+    server.setFile("z.bin", deflated);
+    server.setFile("b.bin", blockFrame(0, data.substr(0, 60000)) + blockFrame(64, data.substr(60000)));
+    server.start();
+
+    std::ostringstream log;
+    FtpService ftpService(&log);
+    loginFakeServer(ftpService, server);
+
+    for (auto mode : {COMPRESSED_MODE, BLOCK_MODE}) {
+        auto reports = retrieveWithProgress(ftpService, mode, mode == COMPRESSED_MODE ? "z.bin" : "b.bin", data.size());
+        REQUIRE(!reports.empty());
+        for (const auto &progress : reports)
+            REQUIRE(progress.transferred <= progress.total);
+        REQUIRE(reports.back().done);
+        REQUIRE(reports.back().transferred == data.size());
+    }
+
+    quitFakeServer(ftpService);
+    server.wait();
+}
+
+
+TEST_CASE("FtpService reports a local file that cannot be read as a file error", "[FtpService]") {
+    FakeFtpServer server;
+    server.start();
+
+    std::ostringstream log;
+    FtpService ftpService(&log);
+    loginFakeServer(ftpService, server);
+
+    // block mode reads the file through a buffer, and a directory fails that read
+    FtpCtrlReply reply;
+    ftpService.sendMODE(BLOCK_MODE);
+    ftpService.readCtrlReply(reply);
+    ftpService.setTransferMode(BLOCK_MODE);
+
+    ftpService.sendPASV();
+    ftpService.readCtrlReply(reply);
+    std::string ipAddr;
+    uint16_t port;
+    FtpService::parsePASVReply(reply.msg, ipAddr, port);
+    ftpService.openPassiveDataConnect(ipAddr, port);
+
+    ftpService.sendSTOR("up.bin");
+    ftpService.readCtrlReply(reply);
+    int dirfd = open("/", O_RDONLY | O_DIRECTORY);
+    REQUIRE(dirfd != -1);
+    bool sent = ftpService.sendDataConnect(dirfd, 0, 10);
+    int readError = errno;
+    close(dirfd);
+    ftpService.closeDataConnect();
+    ftpService.readCtrlReply(reply);
+    REQUIRE_FALSE(sent);
+    REQUIRE(readError == EISDIR);
+
+    quitFakeServer(ftpService);
+    server.wait();
+}
+
+
+TEST_CASE("AsyncFtpSession times out waiting for the greeting", "[AsyncFtpSession]") {
+    // the connection is taken into the backlog of the listener, but no greeting ever comes
+    LoopbackListener listener;
+    std::ostringstream log;
+    EventLoop loop;
+    AsyncFtpSession session(loop, &log);
+    session.setTimeouts({std::chrono::milliseconds(1000), std::chrono::milliseconds(0), std::chrono::milliseconds(100),
+                         std::chrono::milliseconds(0)});
+    session.open("127.0.0.1", listener.port(), "user", "password");
+
+    // the session fails on the idle timer, and nothing is left to run afterwards
+    loop.run();
+    REQUIRE(session.state() == AsyncFtpSession::FAILED);
+    REQUIRE(session.error() == TimeoutException("reading socket").what());
+    REQUIRE(loop.timerCount() == 0);
+}
 
 
 //static void connectLegitServer(FtpService &ftpService) {
@@ -0,0 +1,64 @@
+#include <chrono>
+#include "catch.hpp"
+#include "TokenBucket.h"
+
+
+/*
+ * The rate is slow enough that the tokens earned while a test runs are far below the tolerance
+ */
+static const uint64_t RATE = 1000;
+
+
+static double seconds(std::chrono::nanoseconds wait) {
+    return std::chrono::duration<double>(wait).count();
+}
+
+
+TEST_CASE("TokenBucket without a rate never waits", "[TokenBucket]") {
+    TokenBucket bucket;
+    bucket.setRate(0, 500);
+    REQUIRE(bucket.rate() == 0);
+    REQUIRE(bucket.burst() == 0);
+    REQUIRE(bucket.take(1 << 20).count() == 0);
+}
+
+
+TEST_CASE("TokenBucket holds one second of the rate by default", "[TokenBucket]") {
+    TokenBucket bucket;
+    bucket.setRate(RATE, 0);
+    REQUIRE(bucket.burst() == RATE);
+
+    // the full bucket lets the burst through, and the bytes after it wait for their tokens
+    REQUIRE(bucket.take(RATE).count() == 0);
+    double wait = seconds(bucket.take(RATE / 2));
+    REQUIRE(wait > 0.45);
+    REQUIRE(wait <= 0.5);
+}
+
+
+TEST_CASE("TokenBucket debt adds up over the takes", "[TokenBucket]") {
+    TokenBucket bucket;
+    bucket.setRate(RATE, 200);
+    REQUIRE(bucket.burst() == 200);
+
+    REQUIRE(bucket.take(200).count() == 0);
+    double first = seconds(bucket.take(100));
+    REQUIRE(first > 0.05);
+    REQUIRE(first <= 0.1);
+
+    // a take while in debt waits for the debt before it as well
+    double second = seconds(bucket.take(100));
+    REQUIRE(second > 0.15);
+    REQUIRE(second <= 0.2);
+}
+
+
+TEST_CASE("TokenBucket refill pays the debt and fills the bucket", "[TokenBucket]") {
+    TokenBucket bucket;
+    bucket.setRate(RATE, 200);
+    REQUIRE(bucket.take(500).count() > 0);
+
+    bucket.refill();
+    REQUIRE(bucket.take(200).count() == 0);
+    REQUIRE(bucket.take(1).count() > 0);
+}